@@ -25,22 +25,46 @@
 #include <ArduinoJson.h>
 #include <LittleFS.h>
 
+#define LEGACY_UTC_OFFSET 19800 ///< UTC offset of the RTC in earlier firmware.
+
 /**
  * @brief Loads the configuration from the file system.
  *
  * This function reads the configuration file stored in the file system and
  * parses it into a JsonDocument. It must be called during the setup process.
+ * An empty document is returned while a filesystem update is in progress.
  *
  * @return JsonDocument containing the parsed configuration data.
  */
 JsonDocument loadConfiguration();
 
+/**
+ * @brief Applies a change to the LittleFS configuration file.
+ *
+ * This function reads the configuration file, passes it to `update` and
+ * writes it back if it changed. Every writer of the configuration file goes
+ * through this function, which holds a lock for the whole read-modify-write
+ * so that updates from the loop, the web server, the group UDP and the Wi-Fi
+ * event tasks are not lost when they overlap. `update` runs with the lock
+ * held and must not touch the configuration file itself. While a filesystem
+ * update is in progress, nothing is written and false is returned.
+ *
+ * @param update A function that modifies the configuration.
+ * @return true if the configuration file is up to date, false otherwise.
+ */
+bool updateConfiguration(std::function<void(JsonDocument &)> update);
+
 /**
  * @brief Handles the connection to a Wi-Fi station.
  *
  * This function attempts to connect the ESP32 to a Wi-Fi network using the
- * provided SSID and password. If the connection is successful, it returns true.
- * Otherwise, it returns false.
+ * provided SSID and password. If the configuration holds a cached BSSID and
+ * channel from a previous connection, a directed fast connect is tried first,
+ * optionally reusing the cached IP lease as a static address when
+ * "reuseLease" is set (see updateWiFiCredentials()). A reused lease is
+ * refreshed later by refreshWiFiLease(). On failure it falls back to a full
+ * scan. The time taken is recorded in `wifiConnectTime`. If the connection is
+ * successful, it returns true. Otherwise, it returns false.
  *
  * @param ssid A pointer to a character array to hold the Wi-Fi SSID.
  * @param ssid_n The size of the SSID character array.
@@ -53,6 +77,57 @@ JsonDocument loadConfiguration();
 bool handleWiFiStation(char *ssid, size_t ssid_n, char *password,
                        size_t password_n, JsonDocument config);
 
+/**
+ * @brief Waits for the Wi-Fi station to reach the connected state.
+ *
+ * This function polls the Wi-Fi status until the connection is established or
+ * the given timeout elapses.
+ *
+ * @param timeout The maximum time to wait, in milliseconds.
+ * @return true if the station connected within the timeout, false otherwise.
+ */
+bool waitForWiFi(unsigned long timeout);
+
+/**
+ * @brief Parses a BSSID string of the form "AA:BB:CC:DD:EE:FF".
+ *
+ * @param str The BSSID string to parse.
+ * @param bssid A pointer to a 6 byte array to hold the parsed BSSID.
+ * @return true if the string is a valid BSSID, false otherwise.
+ */
+bool parseBSSID(const char *str, uint8_t *bssid);
+
+/**
+ * @brief Saves the current access point and IP lease to the LittleFS
+ * configuration file.
+ *
+ * This function stores the BSSID, channel, IP address, gateway, subnet mask
+ * and DNS server of the current connection in the "wifiCache" object of the
+ * configuration file so the next boot can skip the scan. The file is only
+ * rewritten if the values differ from the ones in the given configuration,
+ * avoiding a flash write on every boot.
+ *
+ * @param config The JsonDocument containing configuration data.
+ * @param saveLease Whether to save the IP lease. This must be false while
+ * the cached lease is in use as a static address, so that only leases
+ * obtained from DHCP are cached.
+ * @return true if the cache is up to date, false otherwise.
+ */
+bool saveWiFiCache(JsonDocument config, bool saveLease);
+
+/**
+ * @brief Renews the IP lease with DHCP after a fast connect that reused the
+ * cached lease.
+ *
+ * The cached lease is applied without a conflict check and may have expired
+ * or been reassigned. This function switches the station back to DHCP so the
+ * server can confirm or replace it, and caches the new lease once it is
+ * obtained, recording the total time in `wifiDhcpTime`. The connection is
+ * briefly without an address while DHCP runs. It does nothing if the cached
+ * lease was not reused, and should be called at the end of setup.
+ */
+void refreshWiFiLease();
+
 /**
  * @brief Sets up the device as an Access Point (AP).
  *
@@ -88,6 +163,15 @@ void handleMDNS();
  * The function handles requests for common file types and serves them using
  * the appropriate MIME types. It also sets up the server to handle any other
  * static files present in LittleFS.
+ *
+ * The OTA routes are authenticated with the group key: /api/ota/begin takes
+ * a "signature" (see otaCheckSignature()), and /api/ota/upload and
+ * /api/ota/status must repeat it in the X-OTA-Signature header. Once a group
+ * key is set, /api/groups requires it as "currentKey" to change it, and
+ * /api/group requires it as "groupKey" to send a command.
+ *
+ * While a filesystem update is in progress (see otaFilesystemBusy()), the
+ * routes that read or write LittleFS answer 503.
  */
 void handleWebServer();
 
@@ -95,15 +179,20 @@ void handleWebServer();
  * @brief Updates the SSID and password fields in the LittleFS configuration
  * file.
  *
- * This function modifies only the "ssid" and "password" fields of the existing
- * JSON configuration in the file and writes the updated values back to the
- * file.
+ * This function modifies only the "ssid", "password" and "reuseLease" fields
+ * of the existing JSON configuration in the file, clears the cached access
+ * point and lease of the previous network, and writes the updated values back
+ * to the file.
  *
  * @param newSSID The new SSID to be updated in the configuration.
  * @param newPassword The new password to be updated in the configuration.
+ * @param reuseLease Whether a fast connect should reuse the cached IP lease as
+ * a static address until DHCP refreshes it. Set with the optional
+ * "reuseLease" field of /api/connect.
  * @return true if the update is successful, false otherwise.
  */
-bool updateWiFiCredentials(const char *newSSID, const char *newPassword);
+bool updateWiFiCredentials(const char *newSSID, const char *newPassword,
+                           bool reuseLease);
 
 /**
  * @brief Saves the on and off time settings to the LittleFS configuration file.
@@ -120,6 +209,85 @@ bool updateWiFiCredentials(const char *newSSID, const char *newPassword);
  */
 bool saveTimeSettings(unsigned int onTime, unsigned int offTime);
 
+/**
+ * @brief Saves sunrise, sunset or fixed time schedule rules to the LittleFS
+ * configuration file.
+ *
+ * This function parses the rules with parseScheduleRule(), writes them to the
+ * "onRule" and "offRule" fields of the configuration file and applies them to
+ * the schedule. Rules take precedence over "onTime" and "offTime" until new
+ * fixed times are saved.
+ *
+ * @param onRule The rule for the on edge, e.g. "sunset+15min".
+ * @param offRule The rule for the off edge, e.g. "23:00" or "sunrise".
+ * @return true if the rules are valid and were saved, false otherwise.
+ */
+bool saveScheduleRules(const char *onRule, const char *offRule);
+
+/**
+ * @brief Restores the relay state kept in RTC slow memory after a warm reset.
+ *
+ * This function validates the RTC memory record using its magic value and
+ * checksum. After a warm reset (watchdog, brown-out, software restart) it
+ * restores `isOn` and drives the relay pin immediately, without touching
+ * Wi-Fi or the file system. On a cold boot or if the record is invalid, it
+ * reinitializes the record and returns false so the caller can fall back to
+ * the state persisted in the configuration file.
+ *
+ * @return true if the relay state was restored from RTC memory, false
+ * otherwise.
+ */
+bool restoreRelayState();
+
+/**
+ * @brief Sets the relay state and records it in RTC slow memory.
+ *
+ * This function updates `isOn`, drives the relay pin and stores the new state
+ * and transition time in the RTC memory record. If the state changed, it is
+ * also written to flash with persistRelayState().
+ *
+ * @param on The new relay state.
+ * @param timestamp The time of the transition (unix epoch time), or 0 if the
+ * current time is unknown.
+ */
+void setRelayState(bool on, uint32_t timestamp);
+
+/**
+ * @brief Writes the relay state from RTC memory to the LittleFS configuration
+ * file.
+ *
+ * This function stores the "isOn" and "lastTransition" fields in the
+ * configuration file so that the state survives a cold boot, including a
+ * power loss. It is called on every relay transition and only rewrites the
+ * file if "isOn" changed, so a schedule costs about two writes a day and
+ * repeated commands for the same state cost none.
+ */
+void persistRelayState();
+
+/**
+ * @brief Gets the current UTC time from the NTP client or the RTC.
+ *
+ * The NTP time is preferred; the RTC is used if NTP synchronization failed.
+ * Use utcToLocal() to get the local wall-clock time.
+ *
+ * @param now A reference to a DateTime object to hold the current time.
+ * @return true if a time source is available, false otherwise.
+ */
+bool getCurrentTime(DateTime &now);
+
+/**
+ * @brief Switches the relay at the scheduled on and off times.
+ *
+ * This function converts the current time to local time and compares it
+ * against `turnOn` and `turnOff` at minute resolution. It fires every
+ * scheduled edge passed since the previous call, so a time skipped by a DST
+ * change still switches the relay, and never fires twice when a local hour
+ * repeats. A backward step larger than the DST shift is treated as a clock
+ * correction and the schedule resumes from the new time without firing. It
+ * should be called from the main loop.
+ */
+void handleSchedule();
+
 /**
  * @brief Initializes and configures the RTC for the device.
  *
@@ -132,6 +300,21 @@ bool saveTimeSettings(unsigned int onTime, unsigned int offTime);
  */
 bool handleRTC();
 
+/**
+ * @brief Converts the RTC from local time to UTC once after an upgrade.
+ *
+ * Earlier firmware kept the RTC in IST (UTC+5:30). On the first boot without
+ * the "rtcUtc" flag in the configuration file, this function subtracts
+ * LEGACY_UTC_OFFSET from the RTC and sets the flag, so the correction is
+ * applied exactly once. The flag is written before the RTC is adjusted, so a
+ * failed write never leads to a second correction. New configuration files
+ * are created with the flag set. It should be called after handleRTC() and
+ * before updateRTCFromNTP().
+ *
+ * @return true if the RTC is in UTC, false otherwise.
+ */
+bool migrateRTCToUtc();
+
 /**
  * @brief Updates the RTC time using the NTP server.
  *
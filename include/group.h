@@ -0,0 +1,103 @@
+/**
+ * @file group.h
+ * @brief Function declarations for controlling groups of Lightwave units over
+ * UDP multicast.
+ *
+ * Each unit can be a member of a few named groups. A single authenticated
+ * datagram sent to the multicast group address switches or reschedules every
+ * member at once. Group membership is advertised in an mDNS service record so
+ * that clients can discover the units of a group without querying each one.
+ *
+ * @version 0.1.0
+ * @date 2026-10-18
+ * @author WittyWizard
+ */
+
+#pragma once
+
+#ifndef GROUP_H
+#define GROUP_H
+
+#include "variables.h"
+#include <ArduinoJson.h>
+#include <GroupPacket.h>
+
+#define GROUP_MAX 4      ///< Maximum number of groups per unit.
+#define GROUP_KEY_LEN 64 ///< Maximum shared key length, including NUL.
+
+/**
+ * @brief Loads group membership and starts the group command channel.
+ *
+ * This function reads the "groups" array and the "groupKey" from the
+ * configuration, joins the multicast group and advertises the groups in the
+ * TXT record of the `_lightwave._udp` mDNS service. Wi-Fi modem sleep is
+ * turned off so that commands are received without waiting for a beacon.
+ * The channel stays disabled if no group key is configured. It should be
+ * called after handleMDNS().
+ *
+ * @param config The JsonDocument containing configuration data.
+ * @return true if the channel was started, false otherwise.
+ */
+bool handleGroups(JsonDocument config);
+
+/**
+ * @brief Saves group membership and the shared key to the LittleFS
+ * configuration file.
+ *
+ * This function updates the "groups" and "groupKey" fields of the
+ * configuration file and applies them immediately, including the mDNS TXT
+ * record.
+ *
+ * @param groups The group names this unit is a member of.
+ * @param key The shared key used to authenticate group commands.
+ * @return true if the settings are successfully saved, false otherwise.
+ */
+bool saveGroupSettings(JsonArrayConst groups, const char *key);
+
+/**
+ * @brief Checks that a group name fits a GroupPacket.
+ *
+ * @param group The group name.
+ * @return true if the name is not empty and has at most GROUP_NAME_LEN - 1
+ * characters, false otherwise.
+ */
+bool isGroupName(const char *group);
+
+/**
+ * @brief Returns the shared group key.
+ *
+ * The key also authenticates OTA updates, see otaCheckSignature().
+ *
+ * @return The group key, or an empty string if none is configured.
+ */
+const char *getGroupKey();
+
+/**
+ * @brief Checks a key against the shared group key.
+ *
+ * @param key The key to check.
+ * @return true if no group key is configured or the key matches, false
+ * otherwise.
+ */
+bool checkGroupKey(const char *key);
+
+/**
+ * @brief Sends a command to all members of a group.
+ *
+ * This function builds and signs a GroupPacket and sends it to the multicast
+ * group a few times, as multicast frames are not acknowledged. If this unit
+ * is a member of the group, the command is then applied locally as well,
+ * after sending so that its flash write does not delay the group. Nothing
+ * is sent without a time source, as receivers reject commands without a valid
+ * timestamp.
+ *
+ * @param group The target group name.
+ * @param command One of GroupCommand.
+ * @param onTime The on time for GROUP_SCHEDULE (unix epoch time).
+ * @param offTime The off time for GROUP_SCHEDULE (unix epoch time).
+ * @return true if the datagram was sent, false otherwise.
+ */
+bool sendGroupCommand(const char *group, uint8_t command, uint32_t onTime,
+                      uint32_t offTime);
+
+#endif // GROUP_H
@@ -0,0 +1,183 @@
+/**
+ * @file ota.h
+ * @brief Function declarations for streaming over-the-air updates of the
+ * firmware and the LittleFS image.
+ *
+ * An update is started with the image size and its SHA-256, then the image is
+ * uploaded in one or more requests, each starting at the offset reached so
+ * far. Data is written to flash as it arrives and hashed on the way, so the
+ * image is never held in RAM and a dropped upload can be resumed.
+ *
+ * A new firmware is booted on trial. It is marked valid once it passes the
+ * health check at the end of setup; if it fails the check or keeps resetting
+ * before reaching it, the previous firmware is restored.
+ *
+ * @version 0.1.0
+ * @date 2026-10-18
+ * @author WittyWizard
+ */
+
+#pragma once
+
+#ifndef OTA_H
+#define OTA_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define OTA_MAX_ATTEMPTS 3 ///< Trial boots allowed before rolling back.
+#define OTA_SIGNATURE_HEADER "X-OTA-Signature" ///< Header of upload requests.
+
+/**
+ * @brief Partitions that can be updated.
+ */
+enum OtaTarget : uint8_t {
+  OTA_NONE = 0,       ///< No update in progress.
+  OTA_FIRMWARE = 1,   ///< The inactive app partition.
+  OTA_FILESYSTEM = 2, ///< The LittleFS partition.
+};
+
+/**
+ * @brief Checks the signature of an update request.
+ *
+ * Updates are authenticated with the shared group key. The signature is the
+ * HMAC-SHA256 of "<target>:<size>:<sha256>" as a hex string, where target is
+ * "firmware" or "filesystem" and sha256 is the lowercase hex SHA-256 of the
+ * image, e.g. "firmware:1048576:9f86...". No signature is valid while no
+ * group key is configured, which disables updates.
+ *
+ * @param target The partition to update.
+ * @param size The size of the image in bytes.
+ * @param sha256 The SHA-256 of the image as a hex string.
+ * @param signature The signature as a hex string.
+ * @return true if the signature is valid, false otherwise.
+ */
+bool otaCheckSignature(OtaTarget target, size_t size, const char *sha256,
+                       const char *signature);
+
+/**
+ * @brief Checks that a request belongs to the update that was begun last.
+ *
+ * Uploads and status requests carry the signature of the update they belong
+ * to, as given to otaBegin(), in the X-OTA-Signature header.
+ *
+ * @param signature The signature from the request.
+ * @return true if it matches the last begun update, false otherwise.
+ */
+bool otaAuthorized(const char *signature);
+
+/**
+ * @brief Starts a new update, discarding any other update in progress.
+ *
+ * Beginning the update in progress again keeps its progress, so an
+ * interrupted client can resume from otaOffset(). For a filesystem update,
+ * the configuration file is kept in NVS and LittleFS is unmounted, see
+ * restoreOTAConfig().
+ *
+ * @param target The partition to update.
+ * @param size The size of the image in bytes.
+ * @param sha256 The SHA-256 of the image as a hex string.
+ * @param signature The signature of the request, see otaCheckSignature().
+ * @return true if the update was started or resumed, false otherwise.
+ */
+bool otaBegin(OtaTarget target, size_t size, const char *sha256,
+              const char *signature);
+
+/**
+ * @brief Writes a chunk of the image to flash.
+ *
+ * The chunk must start at the current offset. Flash sectors are erased as the
+ * write reaches them. When the last byte is written, the SHA-256 is checked
+ * and the new image is activated.
+ *
+ * @param offset The offset of the chunk within the image.
+ * @param data A pointer to the chunk data.
+ * @param len The length of the chunk.
+ * @return true if the chunk was written, false otherwise.
+ */
+bool otaWrite(size_t offset, const uint8_t *data, size_t len);
+
+/**
+ * @brief Returns the partition being updated.
+ *
+ * @return The target of the update in progress, or OTA_NONE.
+ */
+OtaTarget otaTarget();
+
+/**
+ * @brief Returns the number of bytes written so far, the offset at which an
+ * interrupted upload resumes.
+ *
+ * @return The current offset.
+ */
+size_t otaOffset();
+
+/**
+ * @brief Returns the size of the image being uploaded.
+ *
+ * @return The image size in bytes.
+ */
+size_t otaSize();
+
+/**
+ * @brief Returns true while a filesystem image is being written.
+ *
+ * LittleFS is unmounted and its partition is overwritten during a filesystem
+ * update, so nothing may mount, read or write it until the device restarts.
+ * File system writers check this and fail instead.
+ *
+ * @return true if a filesystem update is in progress, false otherwise.
+ */
+bool otaFilesystemBusy();
+
+/**
+ * @brief Returns true once the whole image was written, verified and
+ * activated, and the device should be restarted.
+ *
+ * @return true if the update is complete, false otherwise.
+ */
+bool otaComplete();
+
+/**
+ * @brief Returns the last update error.
+ *
+ * @return A description of the last error, or an empty string.
+ */
+const char *otaError();
+
+/**
+ * @brief Writes back the configuration kept in NVS during a filesystem
+ * update.
+ *
+ * otaBegin() copies /config.json to NVS before a filesystem update and this
+ * function writes it into the new image when the update completes. If the
+ * update fails, is given up or is cut short by a power loss, LittleFS is
+ * formatted if it no longer mounts, so that the unit keeps its Wi-Fi
+ * credentials and stays reachable. The copy is only cleared once it was
+ * written. It does nothing if no copy is kept, and must be called in setup
+ * before loadConfiguration().
+ */
+void restoreOTAConfig();
+
+/**
+ * @brief Counts trial boots of a new firmware and rolls back if there are
+ * too many.
+ *
+ * This function must be called at the start of setup.
+ */
+void checkOTARollback();
+
+/**
+ * @brief Runs the health check of a new firmware.
+ *
+ * The firmware is healthy if LittleFS is mounted and the device is connected
+ * to the configured network, or running its access point if no network is
+ * configured. A healthy firmware is marked valid; otherwise the previous
+ * firmware is restored. This function should be called at the end of setup
+ * and does nothing outside of a trial boot.
+ *
+ * @param config The JsonDocument containing configuration data.
+ */
+void checkOTAHealth(JsonDocument config);
+
+#endif // OTA_H
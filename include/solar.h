@@ -0,0 +1,85 @@
+/**
+ * @file solar.h
+ * @brief Function declarations for sunrise and sunset based schedules.
+ *
+ * When the location or the year changes, the sunrise and sunset times of
+ * every day of the year, plus the last day of the previous year and the first
+ * day of the next, are computed once and stored in /solar.bin as minutes from
+ * UTC midnight. The scheduler then reads the entries around the current day
+ * instead of doing any floating-point math.
+ *
+ * @version 0.1.0
+ * @date 2026-10-18
+ * @author WittyWizard
+ */
+
+#pragma once
+
+#ifndef SOLAR_H
+#define SOLAR_H
+
+#include "variables.h"
+
+#define SOLAR_NONE INT16_MIN ///< Marks a day without sunrise or sunset.
+
+/**
+ * @brief Parses a schedule rule.
+ *
+ * Accepted forms are a fixed local time "HH:MM", or "sunrise" or "sunset"
+ * followed by an optional offset such as "+15min", "-30min" or "+1h".
+ *
+ * @param str The rule string.
+ * @param rule A reference to a ScheduleRule object to hold the parsed rule.
+ * @return true if the rule is valid, false otherwise.
+ */
+bool parseScheduleRule(const char *str, ScheduleRule &rule);
+
+/**
+ * @brief Sets the location used for sunrise and sunset.
+ *
+ * The table must then be brought up to date with updateSolarTable().
+ *
+ * @param latitude The latitude in degrees, positive north.
+ * @param longitude The longitude in degrees, positive east.
+ */
+void setLocation(float latitude, float longitude);
+
+/**
+ * @brief Computes the solar table for a year if it is not current.
+ *
+ * The table in /solar.bin is reused if it matches the location and the year;
+ * otherwise it is computed again.
+ * This function is called from setup, when the location is saved and from
+ * handleSchedule(), where it only does work at the turn of the year.
+ * Lookups never compute the table, so they fail until it is current.
+ *
+ * @param year The local year.
+ * @return true if the table is current or no location is set, false
+ * otherwise.
+ */
+bool updateSolarTable(int32_t year);
+
+/**
+ * @brief Saves the location to the LittleFS configuration file and applies
+ * it, computing the solar table for the current year.
+ *
+ * @param latitude The latitude in degrees, positive north.
+ * @param longitude The longitude in degrees, positive east.
+ * @return true if the location is valid and was saved, false otherwise.
+ */
+bool saveLocation(float latitude, float longitude);
+
+/**
+ * @brief Returns the local time of a scheduled edge on a given local day.
+ *
+ * For a fixed rule this is the configured time of day. For a solar rule it
+ * is the sunrise or sunset of that day plus the rule offset.
+ *
+ * @param day The local day (days since 1970-01-01).
+ * @param rule The schedule rule.
+ * @return The local time in minutes since the epoch, or UINT32_MAX if the
+ * event does not occur on that day or no location is set.
+ */
+uint32_t scheduleRuleMinute(uint32_t day, const ScheduleRule &rule);
+
+#endif // SOLAR_H
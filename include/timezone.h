@@ -0,0 +1,127 @@
+/**
+ * @file timezone.h
+ * @brief Function declarations for converting between UTC and local time.
+ *
+ * The timezone is configured with a POSIX TZ string such as
+ * "CET-1CEST,M3.5.0,M10.5.0/3". Once per timezone change, a small table of
+ * the UTC offset transitions of the next few years is computed, so converting
+ * a UTC time to local time is a table lookup instead of calendar math.
+ *
+ * @note Times are kept in UTC internally (NTP, RTC, relay transitions). Only
+ * the schedule and the web interface use local time.
+ *
+ * @version 0.1.0
+ * @date 2026-10-18
+ * @author WittyWizard
+ */
+
+#pragma once
+
+#ifndef TIMEZONE_H
+#define TIMEZONE_H
+
+#include <Arduino.h>
+
+#define TZ_DEFAULT "IST-5:30" ///< Timezone used if none is configured.
+#define TZ_TABLE_YEARS 4      ///< Number of years covered by the table.
+#define TZ_TABLE_SIZE (1 + 2 * TZ_TABLE_YEARS)
+
+/**
+ * @brief A UTC offset that applies from a given UTC time onward.
+ */
+struct TzTransition {
+  uint32_t utc;   ///< Start of the interval (unix epoch time).
+  int32_t offset; ///< UTC offset in seconds during the interval.
+};
+
+/**
+ * @brief Parses a POSIX TZ string and computes the transition table.
+ *
+ * Supported rule formats are Mm.w.d, Jn and n, each with an optional /time.
+ * If the string cannot be parsed, the current timezone is left unchanged.
+ * The transition table is computed on the first lookup after this call, once
+ * the current year is known.
+ *
+ * @param tz The POSIX TZ string.
+ * @return true if the timezone was applied, false otherwise.
+ */
+bool setTimezone(const char *tz);
+
+/**
+ * @brief Checks a POSIX TZ string without applying it.
+ *
+ * @param tz The POSIX TZ string.
+ * @return true if the timezone is valid, false otherwise.
+ */
+bool isValidTimezone(const char *tz);
+
+/**
+ * @brief Saves the timezone to the LittleFS configuration file and applies
+ * it.
+ *
+ * The timezone is only applied once it was saved, so the running timezone
+ * always matches the configuration file.
+ *
+ * @param tz The POSIX TZ string.
+ * @return true if the timezone is valid and was saved, false otherwise.
+ */
+bool saveTimezone(const char *tz);
+
+/**
+ * @brief Returns the UTC offset in effect at the given time.
+ *
+ * Lookups for increasing times advance a cursor through the transition table
+ * and take constant time. The table is recomputed only when the time falls
+ * outside of the years it covers.
+ *
+ * @param utc The time (unix epoch time).
+ * @return The UTC offset in seconds.
+ */
+int32_t utcOffset(uint32_t utc);
+
+/**
+ * @brief Converts a UTC time to local time.
+ *
+ * @param utc The time (unix epoch time).
+ * @return The local wall-clock time expressed as unix epoch time.
+ */
+uint32_t utcToLocal(uint32_t utc);
+
+/**
+ * @brief Converts a local wall-clock time to UTC.
+ *
+ * For a local time that occurs twice, the first occurrence is returned. A
+ * local time that is skipped is moved forward by the size of the gap.
+ *
+ * @param local The local wall-clock time expressed as unix epoch time.
+ * @return The time (unix epoch time).
+ */
+uint32_t localToUtc(uint32_t local);
+
+/**
+ * @brief Returns the size of the daylight saving time shift.
+ *
+ * @return The difference between the DST and standard offsets in seconds, or
+ * 0 if the timezone has no DST.
+ */
+int32_t dstDelta();
+
+/**
+ * @brief Returns the number of days from 1970-01-01 to a calendar date.
+ *
+ * @param y The year.
+ * @param m The month (1-12).
+ * @param d The day of the month (1-31).
+ * @return The number of days since the epoch.
+ */
+int32_t daysFromCivil(int32_t y, uint16_t m, uint16_t d);
+
+/**
+ * @brief Returns the year of a day counted from 1970-01-01.
+ *
+ * @param days The number of days since the epoch.
+ * @return The year.
+ */
+int32_t yearFromDays(int32_t days);
+
+#endif // TIMEZONE_H
@@ -57,7 +57,8 @@ extern WiFiUDP ntpUDP;
  *
  * The NTP client connects to an NTP server to retrieve the current time
  * and ensures that the ESP32's clock is synchronized with the network
- * time, providing a reliable time reference for the device.
+ * time, providing a reliable time reference for the device. It runs in
+ * UTC; the local time offset is applied by the timezone module.
  */
 extern NTPClient timeClient;
 
@@ -80,21 +81,40 @@ extern bool rtcFailed;
 extern bool ntpFailed;
 
 /**
- * @brief DateTime object representing the scheduled turn-off time.
+ * @brief Events a scheduled edge can be tied to.
+ */
+enum ScheduleEvent : uint8_t {
+  SCHEDULE_FIXED = 0,   ///< A fixed local time of day.
+  SCHEDULE_SUNRISE = 1, ///< Sunrise at the configured location.
+  SCHEDULE_SUNSET = 2,  ///< Sunset at the configured location.
+};
+
+/**
+ * @brief Rule for the time of a scheduled on or off edge.
+ */
+struct ScheduleRule {
+  ScheduleEvent event; ///< Event the edge is tied to.
+  int16_t minutes;     ///< Minute of the day for SCHEDULE_FIXED, otherwise
+                       ///< the offset from the solar event in minutes.
+};
+
+/**
+ * @brief Schedule rule for the turn-off time.
  *
- * This object holds the date and time at which the device is scheduled
- * to turn off, allowing for automated control based on the user-defined
- * schedule.
+ * This rule holds the local time at which the device is scheduled to turn
+ * off, either a fixed time of day or an offset from sunrise or sunset,
+ * allowing for automated control based on the user-defined schedule.
  */
-extern DateTime turnOff;
+extern ScheduleRule turnOff;
 
 /**
- * @brief DateTime object representing the scheduled turn-on time.
+ * @brief Schedule rule for the turn-on time.
  *
- * This object holds the date and time at which the device is scheduled
- * to turn on, enabling scheduled operation according to user preferences.
+ * This rule holds the local time at which the device is scheduled to turn
+ * on, either a fixed time of day or an offset from sunrise or sunset,
+ * enabling scheduled operation according to user preferences.
  */
-extern DateTime turnOn;
+extern ScheduleRule turnOn;
 
 /**
  * @brief Boolean indicating the current on/off state of the device.
@@ -105,6 +125,29 @@ extern DateTime turnOn;
  */
 extern bool isOn;
 
+/**
+ * @brief Relay state record kept in RTC slow memory across warm resets.
+ *
+ * The record is validated with a magic value and a CRC32 checksum over all
+ * fields preceding `checksum`.
+ */
+struct RelayState {
+  uint32_t magic;          ///< Marks the record as initialized.
+  uint32_t isOn;           ///< Last relay state.
+  uint32_t lastTransition; ///< Time of the last transition (unix epoch time).
+  uint32_t bootCount;      ///< Number of boots since the last cold boot.
+  uint32_t checksum;       ///< CRC32 of the fields above.
+};
+
+/**
+ * @brief Relay state record stored in RTC slow memory.
+ *
+ * This record is not initialized on reset, so it survives brown-outs,
+ * watchdog resets and software restarts, allowing the relay state to be
+ * restored without any flash access.
+ */
+extern RelayState relayState;
+
 /**
  * @brief Flag indicating if the on/off scheduling times are valid.
  *
@@ -114,6 +157,43 @@ extern bool isOn;
  */
 extern bool validOnOffTimes;
 
+/**
+ * @brief Version of the device state, used as the ETag of API reads.
+ *
+ * This counter is incremented on every change to the relay state, the
+ * schedule or the configuration. It starts from a random value on boot so
+ * that an ETag from before a restart does not match.
+ */
+extern uint32_t stateVersion;
+
+/**
+ * @brief Time taken by the last Wi-Fi station connection attempt.
+ *
+ * This value holds the number of milliseconds spent connecting to the
+ * Wi-Fi network during boot, allowing connect performance to be monitored
+ * across devices.
+ */
+extern unsigned long wifiConnectTime;
+
+/**
+ * @brief Time until the Wi-Fi station obtained an address from DHCP.
+ *
+ * This value holds the number of milliseconds from the start of the
+ * connection attempt until DHCP assigned an address. It equals
+ * `wifiConnectTime` unless the cached lease was reused, in which case it
+ * includes the DHCP refresh done by refreshWiFiLease(). It is 0 until DHCP
+ * completes.
+ */
+extern unsigned long wifiDhcpTime;
+
+/**
+ * @brief Flag indicating if the last Wi-Fi connection used the fast path.
+ *
+ * This boolean is set to true if the station connected using the cached
+ * BSSID and channel, and false if a full scan was required.
+ */
+extern bool wifiFastConnect;
+
 /**
  * @brief GPIO pin number connected to the error LED indicator.
  *
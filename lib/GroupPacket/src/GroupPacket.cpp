@@ -0,0 +1,215 @@
+#include "GroupPacket.h"
+#include <string.h>
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+/**
+ * @brief Incremental SHA-256 state.
+ */
+struct Sha256 {
+  uint32_t state[8]; ///< Hash state.
+  uint8_t block[64]; ///< Pending input.
+  size_t used;       ///< Bytes in `block`.
+  uint64_t length;   ///< Total input length in bytes.
+};
+
+static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+static void sha256Block(Sha256 &sha, const uint8_t *block) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+           (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+  }
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = sha.state[0], b = sha.state[1], c = sha.state[2],
+           d = sha.state[3], e = sha.state[4], f = sha.state[5],
+           g = sha.state[6], h = sha.state[7];
+  for (int i = 0; i < 64; i++) {
+    uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+    uint32_t t1 = h + s1 + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+    uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+    uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  sha.state[0] += a;
+  sha.state[1] += b;
+  sha.state[2] += c;
+  sha.state[3] += d;
+  sha.state[4] += e;
+  sha.state[5] += f;
+  sha.state[6] += g;
+  sha.state[7] += h;
+}
+
+static void sha256Init(Sha256 &sha) {
+  static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                      0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                      0x1f83d9ab, 0x5be0cd19};
+  memcpy(sha.state, initial, sizeof(initial));
+  sha.used = 0;
+  sha.length = 0;
+}
+
+static void sha256Update(Sha256 &sha, const uint8_t *data, size_t len) {
+  sha.length += len;
+  while (len > 0) {
+    size_t n = sizeof(sha.block) - sha.used;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(sha.block + sha.used, data, n);
+    sha.used += n;
+    data += n;
+    len -= n;
+    if (sha.used == sizeof(sha.block)) {
+      sha256Block(sha, sha.block);
+      sha.used = 0;
+    }
+  }
+}
+
+static void sha256Finish(Sha256 &sha, uint8_t *digest) {
+  uint64_t bits = sha.length * 8;
+  uint8_t pad = 0x80;
+  sha256Update(sha, &pad, 1);
+  pad = 0;
+  while (sha.used != 56) {
+    sha256Update(sha, &pad, 1);
+  }
+  uint8_t length[8];
+  for (int i = 0; i < 8; i++) {
+    length[i] = (uint8_t)(bits >> (56 - i * 8));
+  }
+  sha256Update(sha, length, sizeof(length));
+
+  for (int i = 0; i < 8; i++) {
+    digest[i * 4] = (uint8_t)(sha.state[i] >> 24);
+    digest[i * 4 + 1] = (uint8_t)(sha.state[i] >> 16);
+    digest[i * 4 + 2] = (uint8_t)(sha.state[i] >> 8);
+    digest[i * 4 + 3] = (uint8_t)sha.state[i];
+  }
+}
+
+void hmacSha256(const uint8_t *key, size_t keyLen, const uint8_t *data,
+                size_t len, uint8_t *mac) {
+  uint8_t pad[64] = {};
+  Sha256 sha;
+
+  if (keyLen > sizeof(pad)) {
+    sha256Init(sha);
+    sha256Update(sha, key, keyLen);
+    sha256Finish(sha, pad);
+  } else {
+    memcpy(pad, key, keyLen);
+  }
+
+  for (size_t i = 0; i < sizeof(pad); i++) {
+    pad[i] ^= 0x36;
+  }
+  uint8_t inner[32];
+  sha256Init(sha);
+  sha256Update(sha, pad, sizeof(pad));
+  sha256Update(sha, data, len);
+  sha256Finish(sha, inner);
+
+  for (size_t i = 0; i < sizeof(pad); i++) {
+    pad[i] ^= 0x36 ^ 0x5c;
+  }
+  sha256Init(sha);
+  sha256Update(sha, pad, sizeof(pad));
+  sha256Update(sha, inner, sizeof(inner));
+  sha256Finish(sha, mac);
+}
+
+static void signGroupPacket(const GroupPacket &packet, const char *key,
+                            uint8_t *mac) {
+  hmacSha256((const uint8_t *)key, strlen(key), (const uint8_t *)&packet,
+             offsetof(GroupPacket, mac), mac);
+}
+
+void buildGroupPacket(GroupPacket &packet, const char *group, uint8_t command,
+                      uint32_t timestamp, uint32_t nonce, uint32_t onTime,
+                      uint32_t offTime, const char *key) {
+  memset(&packet, 0, sizeof(packet));
+  packet.magic = GROUP_MAGIC;
+  packet.version = GROUP_VERSION;
+  packet.command = command;
+  strncpy(packet.group, group, GROUP_NAME_LEN);
+  packet.timestamp = timestamp;
+  packet.nonce = nonce;
+  packet.onTime = onTime;
+  packet.offTime = offTime;
+  signGroupPacket(packet, key, packet.mac);
+}
+
+bool recordGroupNonce(GroupNonceRing &ring, uint32_t nonce) {
+  for (size_t i = 0; i < ring.count; i++) {
+    if (ring.nonces[i] == nonce) {
+      return false;
+    }
+  }
+  ring.nonces[ring.index] = nonce;
+  ring.index = (ring.index + 1) % GROUP_RECENT;
+  if (ring.count < GROUP_RECENT) {
+    ring.count++;
+  }
+  return true;
+}
+
+GroupVerifyResult verifyGroupPacket(const uint8_t *data, size_t len,
+                                    const char *key, uint32_t now,
+                                    GroupNonceRing &ring, GroupPacket &packet) {
+  if (len != sizeof(GroupPacket)) {
+    return GROUP_MALFORMED;
+  }
+  memcpy(&packet, data, sizeof(packet));
+  if (packet.magic != GROUP_MAGIC || packet.version != GROUP_VERSION) {
+    return GROUP_MALFORMED;
+  }
+
+  uint8_t mac[32];
+  signGroupPacket(packet, key, mac);
+  uint8_t diff = 0;
+  for (size_t i = 0; i < sizeof(mac); i++) {
+    diff |= mac[i] ^ packet.mac[i];
+  }
+  if (diff != 0) {
+    return GROUP_BAD_MAC;
+  }
+
+  uint32_t skew = now > packet.timestamp ? now - packet.timestamp
+                                         : packet.timestamp - now;
+  if (now == 0 || packet.timestamp == 0 || skew > GROUP_TIME_WINDOW) {
+    return GROUP_STALE;
+  }
+
+  if (!recordGroupNonce(ring, packet.nonce)) {
+    return GROUP_REPLAY;
+  }
+  return GROUP_VALID;
+}
@@ -0,0 +1,136 @@
+/**
+ * @file GroupPacket.h
+ * @brief Building and verifying group command datagrams.
+ *
+ * This library holds the parts of the group command channel that do not
+ * depend on the network stack: the wire format, the HMAC-SHA256 signature,
+ * the time window and the rejection of duplicate nonces. It has no Arduino
+ * dependencies so that it can be unit tested on the host.
+ *
+ * @version 0.1.0
+ * @date 2026-10-18
+ * @author WittyWizard
+ */
+
+#pragma once
+
+#ifndef GROUP_PACKET_H
+#define GROUP_PACKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GROUP_ADDRESS "239.76.87.1" ///< Multicast address of the channel.
+#define GROUP_PORT 4210             ///< UDP port of the channel.
+#define GROUP_NAME_LEN 16    ///< Maximum group name length, including NUL.
+#define GROUP_TIME_WINDOW 30 ///< Accepted clock skew of a command, in seconds.
+#define GROUP_RECENT 8       ///< Number of recent nonces remembered.
+#define GROUP_MAGIC 0x4C574743UL ///< Identifies a Lightwave group packet.
+#define GROUP_VERSION 1          ///< Packet format version.
+
+/**
+ * @brief Commands that can be sent to a group.
+ */
+enum GroupCommand : uint8_t {
+  GROUP_OFF = 0,      ///< Turn the relay off.
+  GROUP_ON = 1,       ///< Turn the relay on.
+  GROUP_TOGGLE = 2,   ///< Toggle the relay.
+  GROUP_SCHEDULE = 3, ///< Save new on and off times.
+};
+
+/**
+ * @brief Wire format of a group command datagram.
+ *
+ * The `mac` field holds an HMAC-SHA256 over all preceding bytes, keyed with
+ * the shared group key.
+ */
+struct __attribute__((packed)) GroupPacket {
+  uint32_t magic;             ///< Identifies a Lightwave group packet.
+  uint8_t version;            ///< Packet format version.
+  uint8_t command;            ///< One of GroupCommand.
+  char group[GROUP_NAME_LEN]; ///< Target group name.
+  uint32_t timestamp;         ///< Send time (unix epoch time).
+  uint32_t nonce;             ///< Random value to reject duplicates.
+  uint32_t onTime;            ///< On time for GROUP_SCHEDULE.
+  uint32_t offTime;           ///< Off time for GROUP_SCHEDULE.
+  uint8_t mac[32];            ///< HMAC-SHA256 of the fields above.
+};
+
+/**
+ * @brief Result of verifying a received datagram.
+ */
+enum GroupVerifyResult : uint8_t {
+  GROUP_VALID = 0,     ///< The packet is authentic and new.
+  GROUP_MALFORMED = 1, ///< Wrong size, magic or version.
+  GROUP_BAD_MAC = 2,   ///< The signature does not match the key.
+  GROUP_STALE = 3,     ///< No clock, or outside of the time window.
+  GROUP_REPLAY = 4,    ///< The nonce was seen recently.
+};
+
+/**
+ * @brief Ring of the most recently accepted nonces.
+ */
+struct GroupNonceRing {
+  uint32_t nonces[GROUP_RECENT]; ///< Recent nonces.
+  size_t index;                  ///< Next slot to overwrite.
+  size_t count;                  ///< Number of valid slots.
+};
+
+/**
+ * @brief Computes an HMAC-SHA256.
+ *
+ * @param key A pointer to the key.
+ * @param keyLen The length of the key.
+ * @param data A pointer to the message.
+ * @param len The length of the message.
+ * @param mac A pointer to a 32 byte array to hold the result.
+ */
+void hmacSha256(const uint8_t *key, size_t keyLen, const uint8_t *data,
+                size_t len, uint8_t *mac);
+
+/**
+ * @brief Builds and signs a group command packet.
+ *
+ * @param packet A reference to the packet to fill in.
+ * @param group The target group name.
+ * @param command One of GroupCommand.
+ * @param timestamp The send time (unix epoch time).
+ * @param nonce A random value identifying this command.
+ * @param onTime The on time for GROUP_SCHEDULE (unix epoch time).
+ * @param offTime The off time for GROUP_SCHEDULE (unix epoch time).
+ * @param key The shared group key.
+ */
+void buildGroupPacket(GroupPacket &packet, const char *group, uint8_t command,
+                      uint32_t timestamp, uint32_t nonce, uint32_t onTime,
+                      uint32_t offTime, const char *key);
+
+/**
+ * @brief Records a nonce in the ring.
+ *
+ * @param ring The ring of recent nonces.
+ * @param nonce The nonce to record.
+ * @return true if the nonce is new, false if it was seen recently.
+ */
+bool recordGroupNonce(GroupNonceRing &ring, uint32_t nonce);
+
+/**
+ * @brief Verifies a received datagram.
+ *
+ * The checks run in order: format, signature, time window, nonce. Only a
+ * packet that passes the first three records its nonce. A packet is stale if
+ * the receiver has no clock (`now` is 0), if it carries no timestamp, or if
+ * its timestamp is more than GROUP_TIME_WINDOW seconds away from `now`.
+ *
+ * @param data A pointer to the datagram.
+ * @param len The length of the datagram.
+ * @param key The shared group key.
+ * @param now The current time (unix epoch time), or 0 if unknown.
+ * @param ring The ring of recent nonces.
+ * @param packet A reference to a GroupPacket to hold the decoded packet.
+ * @return The result of the verification.
+ */
+GroupVerifyResult verifyGroupPacket(const uint8_t *data, size_t len,
+                                    const char *key, uint32_t now,
+                                    GroupNonceRing &ring, GroupPacket &packet);
+
+#endif // GROUP_PACKET_H
@@ -1,14 +1,36 @@
 #include "functions.h"
+#include "group.h"
+#include "ota.h"
+#include "solar.h"
+#include "timezone.h"
 #include <ESPAsyncWebServer.h>
 #include <ESPmDNS.h>
 #include <RTClib.h>
 #include <SPI.h>
 #include <WiFi.h>
+#include <esp_system.h>
+#include <rom/crc.h>
 
 #define SSIDAP "Lightwave"
 #define PASSWORDAP "therebelight"
+#define RELAY_STATE_MAGIC 0x4C57524CUL
 
-JsonDocument loadConfiguration() {
+/**
+ * @brief Serialized response body cached until the state version changes.
+ */
+struct CachedResponse {
+  uint32_t version; ///< State version the body was built for.
+  String body;      ///< Serialized response body.
+};
+
+static bool wifiLeaseReused = false;
+static unsigned long wifiConnectStart = 0;
+
+// Serializes access to /config.json, which is updated from the loop, the web
+// server, the group UDP and the Wi-Fi event tasks.
+static SemaphoreHandle_t configMutex = xSemaphoreCreateMutex();
+
+static JsonDocument readConfiguration() {
   if (!LittleFS.begin()) {
     Serial.println(
         "An error has occurred while mounting or formatting LittleFS");
@@ -33,6 +55,7 @@ JsonDocument loadConfiguration() {
 #endif
     doc["ssidAP"] = SSIDAP;
     doc["passwordAP"] = PASSWORDAP;
+    doc["rtcUtc"] = true;
 
     if (serializeJson(doc, file) == 0) {
       Serial.println("Failed to write default configuration to file");
@@ -62,6 +85,78 @@ JsonDocument loadConfiguration() {
   return doc;
 }
 
+JsonDocument loadConfiguration() {
+  if (otaFilesystemBusy()) {
+    Serial.println("Filesystem update in progress, configuration not loaded");
+    return JsonDocument();
+  }
+
+  xSemaphoreTake(configMutex, portMAX_DELAY);
+  JsonDocument doc = readConfiguration();
+  xSemaphoreGive(configMutex);
+  return doc;
+}
+
+static bool writeConfiguration(std::function<void(JsonDocument &)> &update) {
+  if (!LittleFS.begin()) {
+    Serial.println(
+        "An error has occurred while mounting or formatting LittleFS");
+    return false;
+  }
+
+  File file = LittleFS.open("/config.json", "r");
+  if (!file) {
+    Serial.println("Failed to open configuration file for reading");
+    return false;
+  }
+
+  String original = file.readString();
+  file.close();
+
+  JsonDocument doc;
+  DeserializationError error = deserializeJson(doc, original);
+  if (error) {
+    Serial.print("Failed to parse configuration file: ");
+    Serial.println(error.c_str());
+    return false;
+  }
+
+  update(doc);
+
+  String updated;
+  serializeJson(doc, updated);
+  if (updated == original) {
+    return true;
+  }
+
+  file = LittleFS.open("/config.json", "w");
+  if (!file) {
+    Serial.println("Failed to open configuration file for writing");
+    return false;
+  }
+
+  if (file.print(updated) != updated.length()) {
+    Serial.println("Failed to write configuration file");
+    file.close();
+    return false;
+  }
+
+  file.close();
+  return true;
+}
+
+bool updateConfiguration(std::function<void(JsonDocument &)> update) {
+  if (otaFilesystemBusy()) {
+    Serial.println("Filesystem update in progress, configuration not saved");
+    return false;
+  }
+
+  xSemaphoreTake(configMutex, portMAX_DELAY);
+  bool written = writeConfiguration(update);
+  xSemaphoreGive(configMutex);
+  return written;
+}
+
 bool handleWiFiStation(char *ssid, size_t ssid_n, char *password,
                        size_t password_n, JsonDocument config) {
 
@@ -71,27 +166,143 @@ bool handleWiFiStation(char *ssid, size_t ssid_n, char *password,
   Serial.print("Connecting to WiFi SSID: ");
   Serial.println(ssid);
 
-  WiFi.begin(ssid, password);
-
   unsigned long startAttemptTime = millis();
+  wifiConnectStart = startAttemptTime;
+  const unsigned long fastConnectionTimeout = 3000;
   const unsigned long connectionTimeout = 10000;
+  bool connected = false;
+
+  uint8_t bssid[6];
+  int32_t channel = config["wifiCache"]["channel"] | 0;
+  wifiFastConnect = false;
+  wifiLeaseReused = false;
+
+  if (channel > 0 && parseBSSID(config["wifiCache"]["bssid"] | "", bssid)) {
+    Serial.println("Trying fast connect with cached BSSID and channel");
+
+    IPAddress ip, gateway, subnet, dns;
+    bool reuseLease = config["reuseLease"] | false;
+    if (reuseLease && ip.fromString(config["wifiCache"]["ip"] | "") &&
+        gateway.fromString(config["wifiCache"]["gateway"] | "") &&
+        subnet.fromString(config["wifiCache"]["subnet"] | "")) {
+      if (!dns.fromString(config["wifiCache"]["dns"] | "")) {
+        dns = gateway;
+      }
+      WiFi.config(ip, gateway, subnet, dns);
+      wifiLeaseReused = true;
+    }
 
-  while (WiFi.status() != WL_CONNECTED) {
-    Serial.print(".");
-    delay(500);
+    WiFi.begin(ssid, password, channel, bssid);
+    connected = waitForWiFi(fastConnectionTimeout);
 
-    if (millis() - startAttemptTime >= connectionTimeout) {
-      Serial.println("\nConnection Timeout: Failed to connect to WiFi.");
-      return false;
+    if (connected) {
+      wifiFastConnect = true;
+    } else {
+      Serial.println("\nFast connect failed, falling back to full scan");
+      WiFi.disconnect();
+      WiFi.config(IPAddress(), IPAddress(), IPAddress());
+      wifiLeaseReused = false;
     }
   }
 
+  if (!connected) {
+    WiFi.begin(ssid, password);
+    connected = waitForWiFi(connectionTimeout);
+  }
+
+  wifiConnectTime = millis() - startAttemptTime;
+  wifiDhcpTime = connected && !wifiLeaseReused ? wifiConnectTime : 0;
+
+  if (!connected) {
+    Serial.println("\nConnection Timeout: Failed to connect to WiFi.");
+    return false;
+  }
+
   Serial.println("\nConnected to WiFi!");
   Serial.print("IP Address: ");
   Serial.println(WiFi.localIP());
+  Serial.printf("Connect time: %lu ms (%s)\n", wifiConnectTime,
+                wifiFastConnect ? "fast" : "full scan");
+
+  saveWiFiCache(config, !wifiLeaseReused);
   return (WiFi.status() == WL_CONNECTED);
 }
 
+bool waitForWiFi(unsigned long timeout) {
+  unsigned long startAttemptTime = millis();
+
+  while (WiFi.status() != WL_CONNECTED) {
+    Serial.print(".");
+    delay(100);
+
+    if (millis() - startAttemptTime >= timeout) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool parseBSSID(const char *str, uint8_t *bssid) {
+  return sscanf(str, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &bssid[0], &bssid[1],
+                &bssid[2], &bssid[3], &bssid[4], &bssid[5]) == 6;
+}
+
+bool saveWiFiCache(JsonDocument config, bool saveLease) {
+  String bssid = WiFi.BSSIDstr();
+  int32_t channel = WiFi.channel();
+  String ip = WiFi.localIP().toString();
+  String gateway = WiFi.gatewayIP().toString();
+  String subnet = WiFi.subnetMask().toString();
+  String dns = WiFi.dnsIP().toString();
+
+  JsonObject cache = config["wifiCache"];
+  if (cache["bssid"] == bssid && cache["channel"] == channel &&
+      (!saveLease || (cache["ip"] == ip && cache["gateway"] == gateway &&
+                      cache["subnet"] == subnet && cache["dns"] == dns))) {
+    return true;
+  }
+
+  if (!updateConfiguration([&](JsonDocument &doc) {
+        doc["wifiCache"]["bssid"] = bssid;
+        doc["wifiCache"]["channel"] = channel;
+        if (saveLease) {
+          doc["wifiCache"]["ip"] = ip;
+          doc["wifiCache"]["gateway"] = gateway;
+          doc["wifiCache"]["subnet"] = subnet;
+          doc["wifiCache"]["dns"] = dns;
+        }
+      })) {
+    Serial.println("Failed to write Wi-Fi cache to file");
+    return false;
+  }
+
+  Serial.println("Wi-Fi cache updated successfully in /config.json");
+  return true;
+}
+
+void refreshWiFiLease() {
+  if (!wifiLeaseReused) {
+    return;
+  }
+
+  WiFi.onEvent(
+      [](WiFiEvent_t event, WiFiEventInfo_t info) {
+        if (!wifiLeaseReused) {
+          return;
+        }
+        wifiLeaseReused = false;
+        wifiDhcpTime = millis() - wifiConnectStart;
+        Serial.print("DHCP lease refreshed, IP Address: ");
+        Serial.println(WiFi.localIP());
+        Serial.printf("Time to DHCP lease: %lu ms\n", wifiDhcpTime);
+        saveWiFiCache(loadConfiguration(), true);
+      },
+      ARDUINO_EVENT_WIFI_STA_GOT_IP);
+
+  Serial.println("Refreshing the cached lease with DHCP");
+  WiFi.config(IPAddress(), IPAddress(), IPAddress());
+}
+
 void handleAP(char *ssid, size_t ssid_n, char *password, size_t password_n,
               JsonDocument config) {
   strlcpy(ssid, config["ssidAP"] | "", ssid_n);
@@ -120,6 +331,63 @@ void handleMDNS() {
   }
 }
 
+static void sendVersionedJson(AsyncWebServerRequest *request,
+                              CachedResponse &cache,
+                              std::function<String()> build) {
+  // Read once, so that the ETag and the cached body always match even if
+  // the state changes while the body is built.
+  uint32_t version = stateVersion;
+  String etag = "\"" + String(version, HEX) + "\"";
+
+  if (request->hasHeader("If-None-Match") &&
+      request->header("If-None-Match").indexOf(etag) >= 0) {
+    AsyncWebServerResponse *response = request->beginResponse(304);
+    response->addHeader("ETag", etag);
+    request->send(response);
+    return;
+  }
+
+  if (cache.body.isEmpty() || cache.version != version) {
+    cache.version = version;
+    cache.body = build();
+  }
+
+  AsyncWebServerResponse *response =
+      request->beginResponse(200, "application/json", cache.body);
+  response->addHeader("ETag", etag);
+  response->addHeader("Cache-Control", "no-cache");
+  request->send(response);
+}
+
+static String otaStatusJson() {
+  JsonDocument doc;
+  OtaTarget target = otaTarget();
+  doc["target"] = target == OTA_FIRMWARE     ? "firmware"
+                  : target == OTA_FILESYSTEM ? "filesystem"
+                                             : "none";
+  doc["size"] = otaSize();
+  doc["offset"] = otaOffset();
+  doc["complete"] = otaComplete();
+  doc["error"] = otaError();
+
+  String response;
+  serializeJson(doc, response);
+  return response;
+}
+
+static bool isOtaRequestAuthorized(AsyncWebServerRequest *request) {
+  return request->hasHeader(OTA_SIGNATURE_HEADER) &&
+         otaAuthorized(request->header(OTA_SIGNATURE_HEADER).c_str());
+}
+
+static bool rejectDuringFilesystemUpdate(AsyncWebServerRequest *request) {
+  if (!otaFilesystemBusy()) {
+    return false;
+  }
+  request->send(503, "text/plain", "Filesystem update in progress");
+  return true;
+}
+
 void handleWebServer() {
   if (!LittleFS.begin()) {
     Serial.println("An error has occurred while mounting LittleFS");
@@ -128,6 +396,9 @@ void handleWebServer() {
   Serial.println("LittleFS mounted successfully");
 
   server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (rejectDuringFilesystemUpdate(request)) {
+      return;
+    }
     request->send(LittleFS, "/index.html", "text/html");
   });
 
@@ -138,14 +409,20 @@ void handleWebServer() {
         handleJsonRequest(
             request, data, len, index, total,
             [](AsyncWebServerRequest *request, JsonDocument &doc) {
+              if (rejectDuringFilesystemUpdate(request)) {
+                return;
+              }
+
               String ssid = doc["ssid"] | "";
               String password = doc["password"] | "";
+              bool reuseLease = doc["reuseLease"] | false;
 
               if (ssid != "" && password != "") {
                 Serial.printf("Received SSID: %s, Password: %s\n", ssid.c_str(),
                               password.c_str());
 
-                if (updateWiFiCredentials(ssid.c_str(), password.c_str())) {
+                if (updateWiFiCredentials(ssid.c_str(), password.c_str(),
+                                          reuseLease)) {
                   request->send(200, "text/plain",
                                 "Wi-Fi credentials received and saved. "
                                 "Attempting to connect...");
@@ -168,10 +445,28 @@ void handleWebServer() {
         handleJsonRequest(
             request, data, len, index, total,
             [](AsyncWebServerRequest *request, JsonDocument &doc) {
+              if (rejectDuringFilesystemUpdate(request)) {
+                return;
+              }
+
               int onTime = doc["onTime"] | 0;
               int offTime = doc["offTime"] | 0;
+              String onRule = doc["onRule"] | "";
+              String offRule = doc["offRule"] | "";
+
+              if (onRule != "" && offRule != "") {
+                Serial.printf("Received onRule: %s, offRule: %s\n",
+                              onRule.c_str(), offRule.c_str());
 
-              if (onTime != 0 && offTime != 0) {
+                if (saveScheduleRules(onRule.c_str(), offRule.c_str())) {
+                  request->send(
+                      200, "text/plain",
+                      "Schedule rules received and saved successfully.");
+                } else {
+                  request->send(400, "text/plain",
+                                "Invalid or unsaved schedule rules.");
+                }
+              } else if (onTime != 0 && offTime != 0) {
                 DateTime onTimeParse = DateTime(onTime);
                 DateTime offTimeParse = DateTime(offTime);
                 Serial.printf("Received onTime: %i:%i, offTime: %i:%i \n",
@@ -202,7 +497,7 @@ void handleWebServer() {
               unsigned int currentTime = doc["currentTime"] | 0;
 
               if (currentTime != 0) {
-                DateTime parsedTime = DateTime(currentTime);
+                DateTime parsedTime = DateTime(localToUtc(currentTime));
                 rtc.adjust(parsedTime);
                 request->send(200, "text/plain",
                               "Time settings received and saved successfully.");
@@ -212,8 +507,215 @@ void handleWebServer() {
             });
       });
 
+  server.on(
+      "/api/timezone", HTTP_POST, [](AsyncWebServerRequest *request) {},
+      nullptr,
+      [](AsyncWebServerRequest *request, uint8_t *data, size_t len,
+         size_t index, size_t total) {
+        handleJsonRequest(
+            request, data, len, index, total,
+            [](AsyncWebServerRequest *request, JsonDocument &doc) {
+              if (rejectDuringFilesystemUpdate(request)) {
+                return;
+              }
+
+              String timezone = doc["timezone"] | "";
+
+              if (timezone == "") {
+                request->send(400, "text/plain", "Missing timezone");
+              } else if (!isValidTimezone(timezone.c_str())) {
+                request->send(400, "text/plain", "Invalid timezone");
+              } else if (saveTimezone(timezone.c_str())) {
+                request->send(200, "text/plain",
+                              "Timezone received and saved successfully.");
+              } else {
+                request->send(500, "text/plain", "Failed to save timezone.");
+              }
+            });
+      });
+
+  server.on(
+      "/api/location", HTTP_POST, [](AsyncWebServerRequest *request) {},
+      nullptr,
+      [](AsyncWebServerRequest *request, uint8_t *data, size_t len,
+         size_t index, size_t total) {
+        handleJsonRequest(
+            request, data, len, index, total,
+            [](AsyncWebServerRequest *request, JsonDocument &doc) {
+              if (rejectDuringFilesystemUpdate(request)) {
+                return;
+              }
+
+              if (!doc["latitude"].is<float>() ||
+                  !doc["longitude"].is<float>()) {
+                request->send(400, "text/plain",
+                              "Missing latitude or longitude");
+              } else if (saveLocation(doc["latitude"], doc["longitude"])) {
+                request->send(200, "text/plain",
+                              "Location received and saved successfully.");
+              } else {
+                request->send(400, "text/plain", "Invalid location");
+              }
+            });
+      });
+
+  server.on(
+      "/api/groups", HTTP_POST, [](AsyncWebServerRequest *request) {}, nullptr,
+      [](AsyncWebServerRequest *request, uint8_t *data, size_t len,
+         size_t index, size_t total) {
+        handleJsonRequest(
+            request, data, len, index, total,
+            [](AsyncWebServerRequest *request, JsonDocument &doc) {
+              if (rejectDuringFilesystemUpdate(request)) {
+                return;
+              }
+
+              JsonArrayConst groups = doc["groups"];
+              String key = doc["groupKey"] | "";
+
+              bool validNames = true;
+              for (JsonVariantConst group : groups) {
+                validNames &= isGroupName(group | "");
+              }
+
+              if (!checkGroupKey(doc["currentKey"] | "")) {
+                request->send(401, "text/plain", "Invalid currentKey");
+              } else if (!validNames) {
+                request->send(400, "text/plain", "Invalid group name");
+              } else if (!groups.isNull() && key != "") {
+                if (saveGroupSettings(groups, key.c_str())) {
+                  request->send(200, "text/plain",
+                                "Group settings received and saved.");
+                } else {
+                  request->send(500, "text/plain",
+                                "Failed to save group settings.");
+                }
+              } else {
+                request->send(400, "text/plain", "Missing groups or groupKey");
+              }
+            });
+      });
+
+  server.on(
+      "/api/group", HTTP_POST, [](AsyncWebServerRequest *request) {}, nullptr,
+      [](AsyncWebServerRequest *request, uint8_t *data, size_t len,
+         size_t index, size_t total) {
+        handleJsonRequest(
+            request, data, len, index, total,
+            [](AsyncWebServerRequest *request, JsonDocument &doc) {
+              String group = doc["group"] | "";
+              String command = doc["command"] | "";
+              unsigned int onTime = doc["onTime"] | 0;
+              unsigned int offTime = doc["offTime"] | 0;
+
+              if (!checkGroupKey(doc["groupKey"] | "")) {
+                request->send(401, "text/plain", "Invalid groupKey");
+                return;
+              }
+
+              uint8_t groupCommand;
+              if (command == "off") {
+                groupCommand = GROUP_OFF;
+              } else if (command == "on") {
+                groupCommand = GROUP_ON;
+              } else if (command == "toggle") {
+                groupCommand = GROUP_TOGGLE;
+              } else if (command == "schedule" && onTime != 0 &&
+                         offTime != 0) {
+                groupCommand = GROUP_SCHEDULE;
+              } else {
+                request->send(400, "text/plain", "Invalid group command");
+                return;
+              }
+
+              if (!isGroupName(group.c_str())) {
+                request->send(400, "text/plain", "Missing or invalid group");
+              } else if (sendGroupCommand(group.c_str(), groupCommand, onTime,
+                                          offTime)) {
+                request->send(200, "text/plain", "Group command sent.");
+              } else {
+                request->send(500, "text/plain",
+                              "Failed to send group command.");
+              }
+            });
+      });
+
+  server.on(
+      "/api/ota/begin", HTTP_POST, [](AsyncWebServerRequest *request) {},
+      nullptr,
+      [](AsyncWebServerRequest *request, uint8_t *data, size_t len,
+         size_t index, size_t total) {
+        handleJsonRequest(
+            request, data, len, index, total,
+            [](AsyncWebServerRequest *request, JsonDocument &doc) {
+              String target = doc["target"] | "";
+              size_t size = doc["size"] | 0;
+              String sha256 = doc["sha256"] | "";
+              String signature = doc["signature"] | "";
+
+              OtaTarget uploadTarget = target == "firmware"     ? OTA_FIRMWARE
+                                       : target == "filesystem" ? OTA_FILESYSTEM
+                                                                : OTA_NONE;
+              if (uploadTarget == OTA_NONE || size == 0 || sha256 == "") {
+                request->send(400, "text/plain",
+                              "Missing target, size or sha256");
+              } else if (!otaCheckSignature(uploadTarget, size, sha256.c_str(),
+                                            signature.c_str())) {
+                request->send(401, "text/plain", "Invalid signature");
+              } else if (otaBegin(uploadTarget, size, sha256.c_str(),
+                                  signature.c_str())) {
+                request->send(200, "application/json", otaStatusJson());
+              } else {
+                request->send(400, "application/json", otaStatusJson());
+              }
+            });
+      });
+
+  server.on(
+      "/api/ota/upload", HTTP_POST,
+      [](AsyncWebServerRequest *request) {
+        size_t offset = request->hasParam("offset")
+                            ? request->getParam("offset")->value().toInt()
+                            : 0;
+
+        if (!isOtaRequestAuthorized(request)) {
+          request->send(401, "text/plain", "Invalid signature");
+        } else if (otaComplete()) {
+          request->send(200, "application/json", otaStatusJson());
+          delay(500);
+          ESP.restart();
+        } else if (otaTarget() != OTA_NONE &&
+                   otaOffset() == offset + request->contentLength()) {
+          request->send(200, "application/json", otaStatusJson());
+        } else if (otaTarget() != OTA_NONE) {
+          request->send(409, "application/json", otaStatusJson());
+        } else {
+          request->send(500, "application/json", otaStatusJson());
+        }
+      },
+      nullptr,
+      [](AsyncWebServerRequest *request, uint8_t *data, size_t len,
+         size_t index, size_t total) {
+        size_t offset = request->hasParam("offset")
+                            ? request->getParam("offset")->value().toInt()
+                            : 0;
+
+        if (isOtaRequestAuthorized(request) && offset + index == otaOffset()) {
+          otaWrite(offset + index, data, len);
+        }
+      });
+
+  server.on("/api/ota/status", HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (isOtaRequestAuthorized(request)) {
+      request->send(200, "application/json", otaStatusJson());
+    } else {
+      request->send(401, "text/plain", "Invalid signature");
+    }
+  });
+
   server.on("/api/toggle", HTTP_GET, [](AsyncWebServerRequest *request) {
-    isOn = !isOn;
+    DateTime now;
+    setRelayState(!isOn, getCurrentTime(now) ? now.unixtime() : 0);
 
     String response = "{\"isOn\": " + String(isOn ? "true" : "false") + "}";
     request->send(200, "application/json", response);
@@ -221,107 +723,242 @@ void handleWebServer() {
     Serial.println("State toggled: " + String(isOn ? "On" : "Off"));
   });
 
-  server.on("/toggleGet", HTTP_GET, [](AsyncWebServerRequest *request) {
-    String response = "{\"isOn\": " + String(isOn ? "true" : "false") + "}";
+  server.on("/api/wifiStats", HTTP_GET, [](AsyncWebServerRequest *request) {
+    String response = "{\"connectTime\": " + String(wifiConnectTime) +
+                      ", \"dhcpTime\": " + String(wifiDhcpTime) +
+                      ", \"fastConnect\": " +
+                      String(wifiFastConnect ? "true" : "false") +
+                      ", \"rssi\": " + String(WiFi.RSSI()) + "}";
     request->send(200, "application/json", response);
   });
 
-  server.serveStatic("/", LittleFS, "/");
+  server.on("/toggleGet", HTTP_GET, [](AsyncWebServerRequest *request) {
+    static CachedResponse cache;
+    sendVersionedJson(request, cache, []() {
+      return "{\"isOn\": " + String(isOn ? "true" : "false") + "}";
+    });
+  });
+
+  server.on("/api/config", HTTP_GET, [](AsyncWebServerRequest *request) {
+    if (rejectDuringFilesystemUpdate(request)) {
+      return;
+    }
+    static CachedResponse cache;
+    sendVersionedJson(request, cache, []() {
+      JsonDocument doc = loadConfiguration();
+      doc.remove("password");
+      doc.remove("passwordAP");
+      doc.remove("groupKey");
+      doc.remove("wifiCache");
+      // The file can lag behind the relay, so report the live state.
+      doc["isOn"] = isOn;
+      doc["lastTransition"] = relayState.lastTransition;
+
+      String response;
+      serializeJson(doc, response);
+      return response;
+    });
+  });
+
+  server.serveStatic("/", LittleFS, "/").setFilter(
+      [](AsyncWebServerRequest *request) { return !otaFilesystemBusy(); });
+  server.onNotFound([](AsyncWebServerRequest *request) {
+    if (!rejectDuringFilesystemUpdate(request)) {
+      request->send(404, "text/plain", "Not found");
+    }
+  });
   server.begin();
   Serial.println("Web server started");
 }
 
-bool updateWiFiCredentials(const char *newSSID, const char *newPassword) {
-  if (!LittleFS.begin()) {
-    Serial.println(
-        "An error has occurred while mounting or formatting LittleFS");
+bool updateWiFiCredentials(const char *newSSID, const char *newPassword,
+                           bool reuseLease) {
+  if (!updateConfiguration([&](JsonDocument &doc) {
+        doc["ssid"] = newSSID;
+        doc["password"] = newPassword;
+        doc["reuseLease"] = reuseLease;
+        doc.remove("wifiCache");
+      })) {
+    Serial.println("Failed to write updated configuration to file");
     return false;
   }
 
-  File file = LittleFS.open("/config.json", "r");
-  if (!file) {
-    Serial.println("Failed to open configuration file for reading");
+  Serial.println("Wi-Fi credentials updated successfully in /config.json");
+  stateVersion++;
+  return true;
+}
+
+bool saveTimeSettings(unsigned int onTime, unsigned int offTime) {
+  if (!updateConfiguration([&](JsonDocument &doc) {
+        doc["onTime"] = onTime;
+        doc["offTime"] = offTime;
+        doc.remove("onRule");
+        doc.remove("offRule");
+      })) {
+    Serial.println("Failed to write time settings to file");
     return false;
   }
 
-  JsonDocument doc;
-  DeserializationError error = deserializeJson(doc, file);
+  DateTime onTimeParse = DateTime(onTime);
+  DateTime offTimeParse = DateTime(offTime);
+  turnOn = {SCHEDULE_FIXED,
+            (int16_t)(onTimeParse.hour() * 60 + onTimeParse.minute())};
+  turnOff = {SCHEDULE_FIXED,
+             (int16_t)(offTimeParse.hour() * 60 + offTimeParse.minute())};
+  validOnOffTimes = true;
 
-  file.close();
+  Serial.println("Time settings saved successfully to /config.json");
+  stateVersion++;
+  return true;
+}
 
-  if (error) {
-    Serial.print("Failed to parse configuration file: ");
-    Serial.println(error.c_str());
+bool saveScheduleRules(const char *onRule, const char *offRule) {
+  ScheduleRule onRuleParse, offRuleParse;
+  if (!parseScheduleRule(onRule, onRuleParse) ||
+      !parseScheduleRule(offRule, offRuleParse)) {
+    Serial.println("Invalid schedule rule");
     return false;
   }
 
-  doc["ssid"] = newSSID;
-  doc["password"] = newPassword;
-
-  file = LittleFS.open("/config.json", "w");
-  if (!file) {
-    Serial.println("Failed to open configuration file for writing");
+  if (!updateConfiguration([&](JsonDocument &doc) {
+        doc["onRule"] = onRule;
+        doc["offRule"] = offRule;
+      })) {
+    Serial.println("Failed to write schedule rules to file");
     return false;
   }
 
-  if (serializeJson(doc, file) == 0) {
-    Serial.println("Failed to write updated configuration to file");
-    file.close();
-    return false;
-  }
+  turnOn = onRuleParse;
+  turnOff = offRuleParse;
+  validOnOffTimes = true;
 
-  file.close();
-  Serial.println("Wi-Fi credentials updated successfully in /config.json");
+  Serial.println("Schedule rules saved successfully to /config.json");
+  stateVersion++;
   return true;
 }
 
-bool saveTimeSettings(unsigned int onTime, unsigned int offTime) {
-  if (!LittleFS.begin()) {
-    Serial.println(
-        "An error has occurred while mounting or formatting LittleFS");
+static uint32_t relayStateChecksum(const RelayState &state) {
+  return crc32_le(0, (const uint8_t *)&state,
+                  offsetof(RelayState, checksum));
+}
+
+bool restoreRelayState() {
+  esp_reset_reason_t reason = esp_reset_reason();
+  bool warmReset = reason != ESP_RST_POWERON && reason != ESP_RST_UNKNOWN;
+
+  if (!warmReset || relayState.magic != RELAY_STATE_MAGIC ||
+      relayState.checksum != relayStateChecksum(relayState)) {
+    relayState.magic = RELAY_STATE_MAGIC;
+    relayState.isOn = 0;
+    relayState.lastTransition = 0;
+    relayState.bootCount = 1;
+    relayState.checksum = relayStateChecksum(relayState);
     return false;
   }
 
-  JsonDocument doc;
-  File file = LittleFS.open("/config.json", "r+");
-  if (!file) {
-    Serial.println("Failed to open time settings file for writing");
-    return false;
+  relayState.bootCount++;
+  relayState.checksum = relayStateChecksum(relayState);
+
+  isOn = relayState.isOn;
+  digitalWrite(relayPin, isOn ? HIGH : LOW);
+  return true;
+}
+
+void setRelayState(bool on, uint32_t timestamp) {
+  bool changed = isOn != on;
+  isOn = on;
+  digitalWrite(relayPin, isOn ? HIGH : LOW);
+
+  relayState.isOn = isOn;
+  relayState.lastTransition = timestamp;
+  relayState.checksum = relayStateChecksum(relayState);
+  stateVersion++;
+
+  if (changed) {
+    persistRelayState();
   }
+}
 
-  DeserializationError error = deserializeJson(doc, file);
-  if (error) {
-    Serial.print("Failed to parse configuration file: ");
-    Serial.println(error.f_str());
-    file.close();
+void persistRelayState() {
+  // Fails during a filesystem update. The RTC memory record carries the
+  // state across the restart that ends the update.
+  updateConfiguration([](JsonDocument &doc) {
+    if (doc["isOn"] != (bool)relayState.isOn) {
+      doc["isOn"] = (bool)relayState.isOn;
+      doc["lastTransition"] = relayState.lastTransition;
+    }
+  });
+}
+
+bool getCurrentTime(DateTime &now) {
+  if (!ntpFailed) {
+    now = DateTime(timeClient.getEpochTime());
+  } else if (!rtcFailed) {
+    now = rtc.now();
+  } else {
     return false;
   }
-  if (doc.isNull()) {
-    Serial.println("Failed to load configuration");
-    return false;
+  return true;
+}
+
+static uint32_t nextScheduleMinute(uint32_t after, const ScheduleRule &rule) {
+  uint32_t day = after / 1440;
+  for (uint32_t d = day - 1; d <= day + 1; d++) {
+    uint32_t minute = scheduleRuleMinute(d, rule);
+    if (minute != UINT32_MAX && minute > after) {
+      return minute;
+    }
   }
-  doc["onTime"] = onTime;
-  doc["offTime"] = offTime;
+  return UINT32_MAX;
+}
 
-  turnOn = DateTime(onTime);
-  turnOff = DateTime(offTime);
-  validOnOffTimes = true;
+void handleSchedule() {
+  static uint32_t lastMinute = 0;
 
-  file = LittleFS.open("/config.json", "w");
-  if (!file) {
-    Serial.println("Failed to open time settings file for writing");
-    return false;
+  if (!validOnOffTimes) {
+    return;
   }
 
-  if (serializeJson(doc, file) == 0) {
-    Serial.println("Failed to write time settings to file");
-    file.close();
-    return false;
+  DateTime now;
+  if (!getCurrentTime(now)) {
+    return;
   }
 
-  file.close();
-  Serial.println("Time settings saved successfully to /config.json");
-  return true;
+  uint32_t utc = now.unixtime();
+  uint32_t minute = utcToLocal(utc) / 60;
+  if (lastMinute == 0) {
+    lastMinute = minute - 1;
+  }
+  if (minute <= lastMinute) {
+    // A step back of up to the DST shift is a repeated local hour whose edges
+    // have already fired. A larger one is a clock correction, so resync.
+    if (lastMinute - minute > (uint32_t)dstDelta() / 60) {
+      lastMinute = minute;
+    }
+    return;
+  }
+  // After a jump forward, only the edges of the last day can matter.
+  if (minute - lastMinute > 1440) {
+    lastMinute = minute - 1440;
+  }
+
+  updateSolarTable(yearFromDays(minute / 1440));
+
+  uint32_t onMinute = nextScheduleMinute(lastMinute, turnOn);
+  uint32_t offMinute = nextScheduleMinute(lastMinute, turnOff);
+  lastMinute = minute;
+
+  bool onDue = onMinute <= minute;
+  bool offDue = offMinute <= minute;
+  if (onDue && (!offDue || onMinute > offMinute)) {
+    if (!isOn) {
+      setRelayState(true, utc);
+    }
+  } else if (offDue) {
+    if (isOn) {
+      setRelayState(false, utc);
+    }
+  }
 }
 
 bool handleRTC() {
@@ -335,6 +972,23 @@ bool handleRTC() {
   return true;
 }
 
+bool migrateRTCToUtc() {
+  bool migrated = false;
+  if (!updateConfiguration([&migrated](JsonDocument &doc) {
+        migrated = doc["rtcUtc"] | false;
+        doc["rtcUtc"] = true;
+      })) {
+    Serial.println("Failed to write RTC migration flag to file");
+    return false;
+  }
+
+  if (!migrated) {
+    rtc.adjust(DateTime(rtc.now().unixtime() - LEGACY_UTC_OFFSET));
+    Serial.println("RTC migrated from local time to UTC");
+  }
+  return true;
+}
+
 bool updateRTCFromNTP() {
   timeClient.begin();
 
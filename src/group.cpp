@@ -0,0 +1,207 @@
+#include "group.h"
+#include "functions.h"
+#include <AsyncUDP.h>
+#include <ESPmDNS.h>
+#include <LittleFS.h>
+#include <WiFi.h>
+
+#define GROUP_REPEAT 3
+#define GROUP_REPEAT_GAP 10
+
+static IPAddress groupAddress;
+static AsyncUDP groupUDP;
+static char groupNames[GROUP_MAX][GROUP_NAME_LEN];
+static size_t groupCount = 0;
+static char groupKey[GROUP_KEY_LEN];
+static GroupNonceRing recentNonces;
+
+static bool isGroupMember(const char *group) {
+  for (size_t i = 0; i < groupCount; i++) {
+    if (strncmp(groupNames[i], group, GROUP_NAME_LEN) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void applyGroupPacket(const GroupPacket &packet) {
+  DateTime now;
+  uint32_t timestamp = getCurrentTime(now) ? now.unixtime() : 0;
+
+  switch (packet.command) {
+  case GROUP_OFF:
+    setRelayState(false, timestamp);
+    break;
+  case GROUP_ON:
+    setRelayState(true, timestamp);
+    break;
+  case GROUP_TOGGLE:
+    setRelayState(!isOn, timestamp);
+    break;
+  case GROUP_SCHEDULE:
+    if (packet.onTime != 0 && packet.offTime != 0) {
+      saveTimeSettings(packet.onTime, packet.offTime);
+    }
+    break;
+  default:
+    return;
+  }
+
+  Serial.printf("Group command %u applied for group %.*s\n", packet.command,
+                GROUP_NAME_LEN, packet.group);
+}
+
+static void handleGroupPacket(AsyncUDPPacket &udpPacket) {
+  if (groupKey[0] == '\0') {
+    return;
+  }
+
+  DateTime now;
+  uint32_t timestamp = getCurrentTime(now) ? now.unixtime() : 0;
+
+  GroupPacket packet;
+  switch (verifyGroupPacket(udpPacket.data(), udpPacket.length(), groupKey,
+                            timestamp, recentNonces, packet)) {
+  case GROUP_VALID:
+    break;
+  case GROUP_BAD_MAC:
+    Serial.println("Rejected group command with invalid signature");
+    return;
+  case GROUP_STALE:
+    Serial.println("Rejected group command outside of time window");
+    return;
+  default:
+    return;
+  }
+
+  if (isGroupMember(packet.group)) {
+    applyGroupPacket(packet);
+  }
+}
+
+static void updateGroupService() {
+  String txt;
+  for (size_t i = 0; i < groupCount; i++) {
+    if (i > 0) {
+      txt += ",";
+    }
+    txt += groupNames[i];
+  }
+
+  MDNS.addService("lightwave", "udp", GROUP_PORT);
+  MDNS.addServiceTxt("lightwave", "udp", "groups", txt.c_str());
+}
+
+static void loadGroups(JsonArrayConst groups, const char *key) {
+  groupCount = 0;
+  for (JsonVariantConst group : groups) {
+    if (groupCount >= GROUP_MAX) {
+      break;
+    }
+    strlcpy(groupNames[groupCount++], group | "", GROUP_NAME_LEN);
+  }
+  strlcpy(groupKey, key, GROUP_KEY_LEN);
+}
+
+bool handleGroups(JsonDocument config) {
+  loadGroups(config["groups"], config["groupKey"] | "");
+
+  if (groupKey[0] == '\0') {
+    Serial.println("No group key configured, group control disabled");
+    return false;
+  }
+
+  groupAddress.fromString(GROUP_ADDRESS);
+  if (!groupUDP.listenMulticast(groupAddress, GROUP_PORT)) {
+    Serial.println("Failed to join group multicast address");
+    return false;
+  }
+
+  groupUDP.onPacket(handleGroupPacket);
+
+  // With modem sleep, multicast frames are only delivered after DTIM beacons,
+  // adding 100-300 ms of skew between members.
+  WiFi.setSleep(false);
+  updateGroupService();
+  Serial.printf("Group control started with %u group(s)\n", groupCount);
+  return true;
+}
+
+bool saveGroupSettings(JsonArrayConst groups, const char *key) {
+  if (!updateConfiguration([&](JsonDocument &doc) {
+        doc["groups"] = groups;
+        doc["groupKey"] = key;
+      })) {
+    Serial.println("Failed to write group settings to file");
+    return false;
+  }
+
+  Serial.println("Group settings saved successfully to /config.json");
+  stateVersion++;
+
+  bool wasEnabled = groupKey[0] != '\0';
+  loadGroups(groups, key);
+  if (wasEnabled) {
+    updateGroupService();
+  } else {
+    JsonDocument config;
+    config["groups"] = groups;
+    config["groupKey"] = key;
+    handleGroups(config);
+  }
+  return true;
+}
+
+bool isGroupName(const char *group) {
+  size_t len = strlen(group);
+  return len > 0 && len < GROUP_NAME_LEN;
+}
+
+const char *getGroupKey() { return groupKey; }
+
+bool checkGroupKey(const char *key) {
+  size_t len = strlen(groupKey);
+  if (len == 0) {
+    return true;
+  }
+  if (strlen(key) != len) {
+    return false;
+  }
+
+  uint8_t diff = 0;
+  for (size_t i = 0; i < len; i++) {
+    diff |= groupKey[i] ^ key[i];
+  }
+  return diff == 0;
+}
+
+bool sendGroupCommand(const char *group, uint8_t command, uint32_t onTime,
+                      uint32_t offTime) {
+  DateTime now;
+  if (groupKey[0] == '\0' || !isGroupName(group) || !getCurrentTime(now)) {
+    return false;
+  }
+
+  GroupPacket packet;
+  buildGroupPacket(packet, group, command, now.unixtime(), esp_random(),
+                   onTime, offTime, groupKey);
+
+  recordGroupNonce(recentNonces, packet.nonce);
+
+  // Multicast is not acknowledged, so the packet is repeated. Receivers drop
+  // the copies by nonce.
+  bool sent = false;
+  for (int i = 0; i < GROUP_REPEAT; i++) {
+    if (i > 0) {
+      delay(GROUP_REPEAT_GAP);
+    }
+    sent |= groupUDP.writeTo((const uint8_t *)&packet, sizeof(packet),
+                             groupAddress, GROUP_PORT) == sizeof(packet);
+  }
+
+  // Applied last, as it writes to flash and would delay the datagrams.
+  if (isGroupMember(packet.group)) {
+    applyGroupPacket(packet);
+  }
+  return sent;
+}
@@ -7,24 +7,55 @@
 #include <SPI.h>
 #include <WiFi.h>
 #include <WiFiUdp.h>
+#include <esp_system.h>
 
 #include "functions.h"
+#include "group.h"
+#include "ota.h"
+#include "solar.h"
+#include "timezone.h"
 #include "variables.h"
 
 void setup() {
   Serial.begin(115200);
+  stateVersion = esp_random();
   pinMode(errorLedPin, OUTPUT);
   pinMode(relayPin, OUTPUT);
   digitalWrite(errorLedPin, LOW);
   digitalWrite(relayPin, LOW);
+  bool relayRestored = restoreRelayState();
+  checkOTARollback();
+  restoreOTAConfig();
 
   JsonDocument config = loadConfiguration();
   serializeJson(config, Serial);
 
-  if (config.containsKey("onTime") && config.containsKey("offTime")) {
+  if (relayRestored) {
+    Serial.printf("\nRelay state restored from RTC memory: %s (boot %u)\n",
+                  isOn ? "On" : "Off", relayState.bootCount);
+  } else {
+    // Written on every transition, so it is current even after a power loss.
+    setRelayState(config["isOn"] | false, config["lastTransition"] | 0);
+  }
+
+  if (!setTimezone(config["timezone"] | TZ_DEFAULT)) {
+    setTimezone(TZ_DEFAULT);
+  }
+
+  if (config.containsKey("latitude") && config.containsKey("longitude")) {
+    setLocation(config["latitude"], config["longitude"]);
+  }
+
+  if (config.containsKey("onRule") && config.containsKey("offRule")) {
+    validOnOffTimes = parseScheduleRule(config["onRule"] | "", turnOn) &&
+                      parseScheduleRule(config["offRule"] | "", turnOff);
+  } else if (config.containsKey("onTime") && config.containsKey("offTime")) {
     validOnOffTimes = true;
-    turnOn = DateTime((unsigned int)config["onTime"]);
-    turnOff = DateTime((unsigned int)config["offTime"]);
+    DateTime onTime = DateTime((unsigned int)config["onTime"]);
+    DateTime offTime = DateTime((unsigned int)config["offTime"]);
+    turnOn = {SCHEDULE_FIXED, (int16_t)(onTime.hour() * 60 + onTime.minute())};
+    turnOff = {SCHEDULE_FIXED,
+               (int16_t)(offTime.hour() * 60 + offTime.minute())};
   } else {
     validOnOffTimes = false;
   }
@@ -38,30 +69,23 @@ void setup() {
   }
 
   rtcFailed = !handleRTC();
+  if (!rtcFailed) {
+    migrateRTCToUtc();
+  }
   ntpFailed = !updateRTCFromNTP();
+
+  DateTime now;
+  if (getCurrentTime(now)) {
+    updateSolarTable(yearFromDays(utcToLocal(now.unixtime()) / 86400));
+  }
   handleWebServer();
   handleMDNS();
+  handleGroups(config);
+  checkOTAHealth(config);
+  refreshWiFiLease();
   if (ntpFailed && rtcFailed) {
     blinkErrorLed();
   }
 }
 
-void loop() {
-  if (validOnOffTimes) {
-    DateTime now;
-    if (!ntpFailed) {
-      now = DateTime(timeClient.getEpochTime());
-    } else if (!rtcFailed) {
-      now = rtc.now();
-    } else {
-      return;
-    }
-    if (now.hour() == turnOn.hour() && now.minute() == turnOn.minute()) {
-      isOn = true;
-    } else if (now.hour() == turnOff.hour() &&
-               now.minute() == turnOff.minute()) {
-      isOn = false;
-    }
-    digitalWrite(relayPin, HIGH);
-  }
-}
+void loop() { handleSchedule(); }
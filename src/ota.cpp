@@ -0,0 +1,327 @@
+#include "ota.h"
+#include "functions.h"
+#include "group.h"
+#include <LittleFS.h>
+#include <Preferences.h>
+#include <WiFi.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <mbedtls/sha256.h>
+
+#define OTA_SECTOR_SIZE 4096
+
+static OtaTarget target = OTA_NONE;
+static const esp_partition_t *partition = nullptr;
+static size_t imageSize = 0;
+static size_t written = 0;
+static size_t erased = 0;
+static bool complete = false;
+static char expectedHash[65];
+static char activeSignature[65];
+static mbedtls_sha256_context sha;
+static String lastError;
+
+// Trial boot state and the configuration backup live in NVS rather than
+// /config.json, as a filesystem update replaces the configuration file.
+static Preferences otaPrefs;
+
+extern "C" bool verifyRollbackLater() { return true; }
+
+static bool backupConfig() {
+  otaPrefs.begin("ota", false);
+  bool backedUp = otaPrefs.isKey("config");
+  if (!backedUp) {
+    JsonDocument config = loadConfiguration();
+    String saved;
+    serializeJson(config, saved);
+    backedUp = config.isNull() ||
+               otaPrefs.putString("config", saved) == saved.length();
+  }
+  otaPrefs.end();
+  return backedUp;
+}
+
+static bool otaFail(const char *error) {
+  Serial.printf("OTA update failed: %s\n", error);
+  lastError = error;
+  target = OTA_NONE;
+  mbedtls_sha256_free(&sha);
+  restoreOTAConfig();
+  return false;
+}
+
+static bool otaFinish() {
+  uint8_t digest[32];
+  char hash[65];
+  mbedtls_sha256_finish(&sha, digest);
+  mbedtls_sha256_free(&sha);
+  for (size_t i = 0; i < sizeof(digest); i++) {
+    sprintf(hash + i * 2, "%02x", digest[i]);
+  }
+
+  if (strcasecmp(hash, expectedHash) != 0) {
+    return otaFail("SHA-256 mismatch");
+  }
+
+  if (target == OTA_FIRMWARE) {
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    if (esp_ota_set_boot_partition(partition) != ESP_OK) {
+      return otaFail("Invalid firmware image");
+    }
+
+    otaPrefs.begin("ota", false);
+    otaPrefs.putBool("pending", true);
+    otaPrefs.putString("previous", running->label);
+    otaPrefs.putUChar("attempts", 0);
+    otaPrefs.end();
+  } else {
+    restoreOTAConfig();
+  }
+
+  complete = true;
+  Serial.println("OTA update verified and activated");
+  return true;
+}
+
+static bool equalsConstantTime(const char *a, const char *b, size_t len) {
+  if (strlen(a) != len || strlen(b) != len) {
+    return false;
+  }
+  uint8_t diff = 0;
+  for (size_t i = 0; i < len; i++) {
+    diff |= tolower(a[i]) ^ tolower(b[i]);
+  }
+  return diff == 0;
+}
+
+bool otaCheckSignature(OtaTarget target, size_t size, const char *sha256,
+                       const char *signature) {
+  const char *key = getGroupKey();
+  if (key[0] == '\0' || strlen(sha256) != 64) {
+    return false;
+  }
+
+  String message = target == OTA_FIRMWARE     ? "firmware:"
+                   : target == OTA_FILESYSTEM ? "filesystem:"
+                                              : "none:";
+  message += String(size) + ":" + String(sha256);
+  message.toLowerCase();
+
+  uint8_t mac[32];
+  char expected[65];
+  hmacSha256((const uint8_t *)key, strlen(key),
+             (const uint8_t *)message.c_str(), message.length(), mac);
+  for (size_t i = 0; i < sizeof(mac); i++) {
+    sprintf(expected + i * 2, "%02x", mac[i]);
+  }
+  return equalsConstantTime(signature, expected, 64);
+}
+
+bool otaAuthorized(const char *signature) {
+  return activeSignature[0] != '\0' &&
+         equalsConstantTime(signature, activeSignature, 64);
+}
+
+bool otaBegin(OtaTarget newTarget, size_t size, const char *sha256,
+              const char *signature) {
+  if (!otaCheckSignature(newTarget, size, sha256, signature)) {
+    return false;
+  }
+  if (target == newTarget && !complete && otaAuthorized(signature)) {
+    Serial.printf("OTA update resumed at %u bytes\n", written);
+    return true;
+  }
+
+  strlcpy(activeSignature, signature, sizeof(activeSignature));
+  if (target != OTA_NONE && !complete) {
+    mbedtls_sha256_free(&sha);
+  }
+  target = OTA_NONE;
+  complete = false;
+  lastError = "";
+
+  // A filesystem update that is given up leaves a partial image behind.
+  if (newTarget != OTA_FILESYSTEM) {
+    restoreOTAConfig();
+  }
+
+  if (newTarget == OTA_FIRMWARE) {
+    partition = esp_ota_get_next_update_partition(nullptr);
+  } else if (newTarget == OTA_FILESYSTEM) {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                         ESP_PARTITION_SUBTYPE_DATA_SPIFFS,
+                                         nullptr);
+  } else {
+    partition = nullptr;
+  }
+
+  if (!partition) {
+    return otaFail("No partition to update");
+  }
+  if (size == 0 || size > partition->size) {
+    return otaFail("Image does not fit the partition");
+  }
+  if (strlen(sha256) != 64) {
+    return otaFail("Invalid SHA-256");
+  }
+
+  if (newTarget == OTA_FILESYSTEM) {
+    // Kept across a failed update or a power loss until otaFinish() or
+    // restoreOTAConfig() has written it back.
+    if (!backupConfig()) {
+      return otaFail("Failed to back up configuration");
+    }
+    LittleFS.end();
+  }
+
+  strlcpy(expectedHash, sha256, sizeof(expectedHash));
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+
+  target = newTarget;
+  imageSize = size;
+  written = 0;
+  erased = 0;
+
+  Serial.printf("OTA update started: %u bytes to %s\n", size,
+                partition->label);
+  return true;
+}
+
+bool otaWrite(size_t offset, const uint8_t *data, size_t len) {
+  if (target == OTA_NONE || complete) {
+    lastError = "No update in progress";
+    return false;
+  }
+  if (offset != written) {
+    lastError = "Unexpected offset";
+    return false;
+  }
+  if (written + len > imageSize) {
+    return otaFail("Image larger than announced");
+  }
+
+  while (erased < written + len) {
+    if (esp_partition_erase_range(partition, erased, OTA_SECTOR_SIZE) !=
+        ESP_OK) {
+      return otaFail("Flash erase failed");
+    }
+    erased += OTA_SECTOR_SIZE;
+  }
+
+  if (esp_partition_write(partition, written, data, len) != ESP_OK) {
+    return otaFail("Flash write failed");
+  }
+
+  mbedtls_sha256_update(&sha, data, len);
+  written += len;
+
+  if (written == imageSize) {
+    return otaFinish();
+  }
+  return true;
+}
+
+OtaTarget otaTarget() { return target; }
+
+size_t otaOffset() { return written; }
+
+size_t otaSize() { return imageSize; }
+
+bool otaComplete() { return complete; }
+
+bool otaFilesystemBusy() { return target == OTA_FILESYSTEM && !complete; }
+
+const char *otaError() { return lastError.c_str(); }
+
+void restoreOTAConfig() {
+  otaPrefs.begin("ota", true);
+  String config = otaPrefs.getString("config", "");
+  otaPrefs.end();
+  if (config.isEmpty()) {
+    return;
+  }
+
+  if (!LittleFS.begin()) {
+    Serial.println("Filesystem image is incomplete, formatting LittleFS");
+    if (!LittleFS.format() || !LittleFS.begin()) {
+      Serial.println("Failed to format LittleFS");
+      return;
+    }
+  }
+
+  File file = LittleFS.open("/config.json", "w");
+  if (!file) {
+    Serial.println("Failed to open configuration file for writing");
+    return;
+  }
+  bool restored = file.print(config) == config.length();
+  file.close();
+  if (!restored) {
+    Serial.println("Failed to restore configuration file");
+    return;
+  }
+
+  otaPrefs.begin("ota", false);
+  otaPrefs.remove("config");
+  otaPrefs.end();
+  Serial.println("Configuration restored after filesystem update");
+}
+
+static void otaRollback() {
+  otaPrefs.begin("ota", false);
+  String previous = otaPrefs.getString("previous", "");
+  otaPrefs.putBool("pending", false);
+  otaPrefs.end();
+
+  const esp_partition_t *previousPartition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, previous.c_str());
+
+  Serial.println("New firmware failed its health check, rolling back");
+  if (previousPartition &&
+      esp_ota_set_boot_partition(previousPartition) == ESP_OK) {
+    ESP.restart();
+  }
+  esp_ota_mark_app_invalid_rollback_and_reboot();
+}
+
+void checkOTARollback() {
+  otaPrefs.begin("ota", false);
+  bool pending = otaPrefs.getBool("pending", false);
+  uint8_t attempts = otaPrefs.getUChar("attempts", 0) + 1;
+  if (pending) {
+    otaPrefs.putUChar("attempts", attempts);
+  }
+  otaPrefs.end();
+
+  if (pending && attempts > OTA_MAX_ATTEMPTS) {
+    otaRollback();
+  }
+}
+
+void checkOTAHealth(JsonDocument config) {
+  otaPrefs.begin("ota", true);
+  bool pending = otaPrefs.getBool("pending", false);
+  otaPrefs.end();
+
+  if (!pending) {
+    esp_ota_mark_app_valid_cancel_rollback();
+    return;
+  }
+
+  // The access point also starts when the station fails to connect, so it
+  // only counts if no network is configured.
+  bool hasStation = strlen(config["ssid"] | "") > 0;
+  bool networkUp = WiFi.isConnected() ||
+                   (!hasStation && WiFi.softAPIP() != IPAddress());
+  if (!LittleFS.begin() || !networkUp) {
+    otaRollback();
+    return;
+  }
+
+  otaPrefs.begin("ota", false);
+  otaPrefs.putBool("pending", false);
+  otaPrefs.end();
+  esp_ota_mark_app_valid_cancel_rollback();
+  Serial.println("New firmware passed its health check");
+}
@@ -0,0 +1,252 @@
+#include "solar.h"
+#include "functions.h"
+#include "ota.h"
+#include "timezone.h"
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+
+#define SOLAR_MAGIC 0x4C57534CUL
+#define SOLAR_DAYS 368
+#define SOLAR_ZENITH 90.833f
+#define SOLAR_CACHE 3
+
+/**
+ * @brief Header of the /solar.bin table.
+ *
+ * The header is followed by SOLAR_DAYS pairs of int16_t sunrise and sunset
+ * times, in minutes from UTC midnight of that day, from December 31 of the
+ * previous year to January 1 of the next year.
+ */
+struct __attribute__((packed)) SolarHeader {
+  uint32_t magic;    ///< Identifies a Lightwave solar table.
+  int32_t year;      ///< Year the table was computed for.
+  int32_t latitude;  ///< Latitude in 1e-4 degrees.
+  int32_t longitude; ///< Longitude in 1e-4 degrees.
+};
+
+static bool locationSet = false;
+static int32_t latitudeE4 = 0;
+static int32_t longitudeE4 = 0;
+static int32_t tableYear = 0;
+
+static uint32_t cachedDays[SOLAR_CACHE] = {UINT32_MAX, UINT32_MAX, UINT32_MAX};
+static int16_t cachedEvents[SOLAR_CACHE][2];
+
+static float normalizeDegrees(float value) {
+  value = fmodf(value, 360.0f);
+  return value < 0 ? value + 360.0f : value;
+}
+
+static int16_t computeSolarEvent(int32_t dayOfYear, bool sunrise,
+                                 float latitude, float longitude) {
+  const float rad = PI / 180.0f;
+  float lngHour = longitude / 15.0f;
+  float expected = (sunrise ? 6.0f : 18.0f) - lngHour;
+  float t = dayOfYear + expected / 24.0f;
+
+  float m = 0.9856f * t - 3.289f;
+  float l = normalizeDegrees(m + 1.916f * sinf(m * rad) +
+                             0.020f * sinf(2 * m * rad) + 282.634f);
+  float ra = normalizeDegrees(atanf(0.91764f * tanf(l * rad)) / rad);
+  ra += floorf(l / 90.0f) * 90.0f - floorf(ra / 90.0f) * 90.0f;
+  ra /= 15.0f;
+
+  float sinDec = 0.39782f * sinf(l * rad);
+  float cosDec = cosf(asinf(sinDec));
+  float cosH = (cosf(SOLAR_ZENITH * rad) - sinDec * sinf(latitude * rad)) /
+               (cosDec * cosf(latitude * rad));
+  if (cosH > 1.0f || cosH < -1.0f) {
+    return SOLAR_NONE;
+  }
+
+  float h = acosf(cosH) / rad;
+  h = (sunrise ? 360.0f - h : h) / 15.0f;
+
+  float ut = h + ra - 0.06571f * t - 6.622f - lngHour;
+  ut -= 24.0f * roundf((ut - expected) / 24.0f);
+  return (int16_t)lroundf(ut * 60.0f);
+}
+
+static bool buildSolarTable(int32_t year) {
+  File file = LittleFS.open("/solar.bin", "w");
+  if (!file) {
+    Serial.println("Failed to open solar table for writing");
+    return false;
+  }
+
+  SolarHeader header = {SOLAR_MAGIC, year, latitudeE4, longitudeE4};
+  file.write((const uint8_t *)&header, sizeof(header));
+
+  // Day 0 is December 31 of the previous year and the last entries run into
+  // the next year, which the formula handles as a continuation.
+  float latitude = latitudeE4 / 10000.0f;
+  float longitude = longitudeE4 / 10000.0f;
+  for (int32_t day = 0; day < SOLAR_DAYS; day++) {
+    int16_t events[2] = {computeSolarEvent(day, true, latitude, longitude),
+                         computeSolarEvent(day, false, latitude, longitude)};
+    file.write((const uint8_t *)events, sizeof(events));
+  }
+
+  file.close();
+  Serial.printf("Solar table computed for %d\n", year);
+  return true;
+}
+
+static bool readSolarHeader(File &file, SolarHeader &header) {
+  return file.read((uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+         header.magic == SOLAR_MAGIC && header.latitude == latitudeE4 &&
+         header.longitude == longitudeE4;
+}
+
+static bool readSolarEvents(uint32_t day, int16_t *events) {
+  if (otaFilesystemBusy()) {
+    return false;
+  }
+
+  File file = LittleFS.open("/solar.bin", "r");
+  if (!file) {
+    return false;
+  }
+
+  SolarHeader header;
+  int32_t index = 0;
+  bool ok = readSolarHeader(file, header);
+  if (ok) {
+    index = day - daysFromCivil(header.year, 1, 1) + 1;
+    ok = index >= 0 && index < SOLAR_DAYS;
+  }
+  ok = ok &&
+       file.seek(sizeof(SolarHeader) + index * 2 * sizeof(int16_t)) &&
+       file.read((uint8_t *)events, 2 * sizeof(int16_t)) ==
+           2 * sizeof(int16_t);
+  file.close();
+  return ok;
+}
+
+bool updateSolarTable(int32_t year) {
+  if (!locationSet || year == tableYear) {
+    return true;
+  }
+  if (otaFilesystemBusy()) {
+    return false;
+  }
+
+  File file = LittleFS.open("/solar.bin", "r");
+  SolarHeader header;
+  bool current = file && readSolarHeader(file, header) && header.year == year;
+  if (file) {
+    file.close();
+  }
+
+  if (!current && !buildSolarTable(year)) {
+    return false;
+  }
+  tableYear = year;
+  for (size_t i = 0; i < SOLAR_CACHE; i++) {
+    cachedDays[i] = UINT32_MAX;
+  }
+  return true;
+}
+
+bool parseScheduleRule(const char *str, ScheduleRule &rule) {
+  unsigned int hour, minute;
+  char extra;
+  if (sscanf(str, "%u:%u%c", &hour, &minute, &extra) == 2) {
+    if (hour > 23 || minute > 59) {
+      return false;
+    }
+    rule.event = SCHEDULE_FIXED;
+    rule.minutes = hour * 60 + minute;
+    return true;
+  }
+
+  if (strncmp(str, "sunrise", 7) == 0) {
+    rule.event = SCHEDULE_SUNRISE;
+    str += 7;
+  } else if (strncmp(str, "sunset", 6) == 0) {
+    rule.event = SCHEDULE_SUNSET;
+    str += 6;
+  } else {
+    return false;
+  }
+
+  rule.minutes = 0;
+  if (*str == '\0') {
+    return true;
+  }
+
+  int offset;
+  char unit[4] = {};
+  if (sscanf(str, "%d%3s%c", &offset, unit, &extra) != 2 ||
+      (*str != '+' && *str != '-')) {
+    return false;
+  }
+  if (strcmp(unit, "h") == 0) {
+    offset *= 60;
+  } else if (strcmp(unit, "min") != 0 && strcmp(unit, "m") != 0) {
+    return false;
+  }
+  if (offset < -720 || offset > 720) {
+    return false;
+  }
+  rule.minutes = offset;
+  return true;
+}
+
+void setLocation(float latitude, float longitude) {
+  latitudeE4 = lroundf(latitude * 10000.0f);
+  longitudeE4 = lroundf(longitude * 10000.0f);
+  locationSet = true;
+  tableYear = 0;
+  for (size_t i = 0; i < SOLAR_CACHE; i++) {
+    cachedDays[i] = UINT32_MAX;
+  }
+}
+
+bool saveLocation(float latitude, float longitude) {
+  if (latitude < -90.0f || latitude > 90.0f || longitude < -180.0f ||
+      longitude > 180.0f) {
+    return false;
+  }
+
+  if (!updateConfiguration([&](JsonDocument &doc) {
+        doc["latitude"] = latitude;
+        doc["longitude"] = longitude;
+      })) {
+    Serial.println("Failed to write location to file");
+    return false;
+  }
+
+  Serial.println("Location saved successfully to /config.json");
+  stateVersion++;
+
+  setLocation(latitude, longitude);
+  DateTime now;
+  if (getCurrentTime(now)) {
+    updateSolarTable(yearFromDays(utcToLocal(now.unixtime()) / 86400));
+  }
+  return true;
+}
+
+uint32_t scheduleRuleMinute(uint32_t day, const ScheduleRule &rule) {
+  if (rule.event == SCHEDULE_FIXED) {
+    return day * 1440 + rule.minutes;
+  }
+  if (!locationSet) {
+    return UINT32_MAX;
+  }
+
+  size_t slot = day % SOLAR_CACHE;
+  if (cachedDays[slot] != day) {
+    if (!readSolarEvents(day, cachedEvents[slot])) {
+      return UINT32_MAX;
+    }
+    cachedDays[slot] = day;
+  }
+
+  int16_t event = cachedEvents[slot][rule.event == SCHEDULE_SUNRISE ? 0 : 1];
+  if (event == SOLAR_NONE) {
+    return UINT32_MAX;
+  }
+  return utcToLocal(day * 86400 + event * 60) / 60 + rule.minutes;
+}
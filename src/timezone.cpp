@@ -0,0 +1,327 @@
+#include "timezone.h"
+#include "functions.h"
+#include "variables.h"
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+
+#define SECONDS_PER_DAY 86400L
+
+/**
+ * @brief A rule for the day and time of a DST transition.
+ */
+struct TzRule {
+  char type;    ///< 'M' for Mm.w.d, 'J' for Jn, 'N' for n.
+  uint16_t m;   ///< Month (Mm.w.d).
+  uint16_t w;   ///< Week of the month (Mm.w.d).
+  uint16_t d;   ///< Day of the week, or day of the year (Jn, n).
+  int32_t time; ///< Local time of day of the transition, in seconds.
+};
+
+/**
+ * @brief A parsed POSIX TZ string.
+ */
+struct TzConfig {
+  int32_t stdOffset; ///< Standard time UTC offset, in seconds.
+  int32_t dstOffset; ///< DST UTC offset, in seconds.
+  bool hasDst;       ///< Whether the timezone observes DST.
+  TzRule start;      ///< Start of DST.
+  TzRule end;        ///< End of DST.
+};
+
+static int32_t stdOffset = 0;
+static int32_t dstOffset = 0;
+static bool hasDst = false;
+static TzRule dstStart;
+static TzRule dstEnd;
+
+static TzTransition tzTable[TZ_TABLE_SIZE];
+static size_t tzCount = 0;
+static size_t tzCursor = 0;
+static uint32_t tzTableEnd = 0;
+
+static bool isLeapYear(int32_t y) {
+  return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+}
+
+static int32_t daysInMonth(int32_t y, uint16_t m) {
+  static const uint8_t days[] = {31, 28, 31, 30, 31, 30,
+                                 31, 31, 30, 31, 30, 31};
+  return (m == 2 && isLeapYear(y)) ? 29 : days[m - 1];
+}
+
+int32_t daysFromCivil(int32_t y, uint16_t m, uint16_t d) {
+  y -= m <= 2;
+  int32_t era = (y >= 0 ? y : y - 399) / 400;
+  uint32_t yoe = (uint32_t)(y - era * 400);
+  uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int32_t)doe - 719468;
+}
+
+int32_t yearFromDays(int32_t days) {
+  days += 719468;
+  int32_t era = (days >= 0 ? days : days - 146096) / 146097;
+  uint32_t doe = (uint32_t)(days - era * 146097);
+  uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  uint32_t mp = (5 * doy + 2) / 153;
+  return (int32_t)yoe + era * 400 + (mp >= 10);
+}
+
+static const char *parseName(const char *p) {
+  if (*p == '<') {
+    while (*p != '\0' && *p != '>') {
+      p++;
+    }
+    return *p == '>' ? p + 1 : nullptr;
+  }
+
+  const char *start = p;
+  while (isalpha(*p)) {
+    p++;
+  }
+  return p - start >= 3 ? p : nullptr;
+}
+
+static const char *parseTime(const char *p, int32_t &seconds) {
+  int32_t sign = 1;
+  if (*p == '+' || *p == '-') {
+    sign = *p == '-' ? -1 : 1;
+    p++;
+  }
+
+  static const int32_t scale[] = {3600, 60, 1};
+  seconds = 0;
+  for (int part = 0; part < 3; part++) {
+    if (!isdigit(*p)) {
+      return nullptr;
+    }
+    int32_t value = 0;
+    while (isdigit(*p)) {
+      value = value * 10 + (*p++ - '0');
+    }
+    seconds += value * scale[part];
+    if (*p != ':' || part == 2) {
+      break;
+    }
+    p++;
+  }
+  seconds *= sign;
+  return p;
+}
+
+static const char *parseNumber(const char *p, uint16_t &value) {
+  if (!isdigit(*p)) {
+    return nullptr;
+  }
+  value = 0;
+  while (isdigit(*p)) {
+    value = value * 10 + (*p++ - '0');
+  }
+  return p;
+}
+
+static const char *parseRule(const char *p, TzRule &rule) {
+  if (*p == 'M') {
+    rule.type = 'M';
+    p = parseNumber(p + 1, rule.m);
+    if (!p || *p != '.' || !(p = parseNumber(p + 1, rule.w)) || *p != '.' ||
+        !(p = parseNumber(p + 1, rule.d))) {
+      return nullptr;
+    }
+    if (rule.m < 1 || rule.m > 12 || rule.w < 1 || rule.w > 5 || rule.d > 6) {
+      return nullptr;
+    }
+  } else if (*p == 'J') {
+    rule.type = 'J';
+    p = parseNumber(p + 1, rule.d);
+    if (!p || rule.d < 1 || rule.d > 365) {
+      return nullptr;
+    }
+  } else {
+    rule.type = 'N';
+    p = parseNumber(p, rule.d);
+    if (!p || rule.d > 365) {
+      return nullptr;
+    }
+  }
+
+  rule.time = 7200;
+  if (*p == '/') {
+    p = parseTime(p + 1, rule.time);
+  }
+  return p;
+}
+
+static int64_t ruleTime(int32_t year, const TzRule &rule) {
+  int32_t days = daysFromCivil(year, 1, 1);
+
+  if (rule.type == 'M') {
+    days = daysFromCivil(year, rule.m, 1);
+    int32_t weekday = (days + 4) % 7;
+    int32_t day = (rule.d - weekday + 7) % 7 + (rule.w - 1) * 7;
+    while (day >= daysInMonth(year, rule.m)) {
+      day -= 7;
+    }
+    days += day;
+  } else if (rule.type == 'J') {
+    days += rule.d - 1 + (isLeapYear(year) && rule.d >= 60);
+  } else {
+    days += rule.d;
+  }
+
+  return (int64_t)days * SECONDS_PER_DAY + rule.time;
+}
+
+static void addTransition(int64_t utc, int32_t offset) {
+  if (tzCount < TZ_TABLE_SIZE && utc > tzTable[tzCount - 1].utc) {
+    tzTable[tzCount].utc = (uint32_t)utc;
+    tzTable[tzCount].offset = offset;
+    tzCount++;
+  }
+}
+
+static void buildTable(int32_t year) {
+  tzCursor = 0;
+  tzTable[0].offset = stdOffset;
+
+  if (!hasDst) {
+    tzTable[0].utc = 0;
+    tzCount = 1;
+    tzTableEnd = UINT32_MAX;
+    return;
+  }
+
+  if (year < 1970) {
+    year = 1970;
+  }
+  tzTable[0].utc = (uint32_t)daysFromCivil(year, 1, 1) * SECONDS_PER_DAY;
+  tzCount = 1;
+
+  for (int32_t y = year; y < year + TZ_TABLE_YEARS; y++) {
+    int64_t start = ruleTime(y, dstStart) - stdOffset;
+    int64_t end = ruleTime(y, dstEnd) - dstOffset;
+
+    if (y == year && end < start) {
+      tzTable[0].offset = dstOffset;
+    }
+    if (start < end) {
+      addTransition(start, dstOffset);
+      addTransition(end, stdOffset);
+    } else {
+      addTransition(end, stdOffset);
+      addTransition(start, dstOffset);
+    }
+  }
+
+  int64_t end = (int64_t)daysFromCivil(year + TZ_TABLE_YEARS, 1, 1) *
+                SECONDS_PER_DAY;
+  tzTableEnd = end > UINT32_MAX ? UINT32_MAX : (uint32_t)end;
+}
+
+static bool parseTimezone(const char *tz, TzConfig &config) {
+  config.start = {'M', 3, 2, 0, 7200};
+  config.end = {'M', 11, 1, 0, 7200};
+
+  const char *p = parseName(tz);
+  if (!p || !(p = parseTime(p, config.stdOffset))) {
+    return false;
+  }
+  config.stdOffset = -config.stdOffset;
+  config.dstOffset = config.stdOffset;
+
+  config.hasDst = *p != '\0';
+  if (config.hasDst) {
+    p = parseName(p);
+    if (p && *p != '\0' && *p != ',') {
+      p = parseTime(p, config.dstOffset);
+      config.dstOffset = -config.dstOffset;
+    } else {
+      config.dstOffset = config.stdOffset + 3600;
+    }
+    if (p && *p == ',') {
+      p = parseRule(p + 1, config.start);
+      if (p && *p == ',') {
+        p = parseRule(p + 1, config.end);
+      } else {
+        p = nullptr;
+      }
+    }
+    if (!p || *p != '\0') {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void applyTimezone(const char *tz, const TzConfig &config) {
+  stdOffset = config.stdOffset;
+  dstOffset = config.dstOffset;
+  hasDst = config.hasDst;
+  dstStart = config.start;
+  dstEnd = config.end;
+
+  tzCount = 0;
+  tzCursor = 0;
+  tzTableEnd = 0;
+
+  Serial.printf("Timezone set to %s\n", tz);
+}
+
+bool isValidTimezone(const char *tz) {
+  TzConfig config;
+  return parseTimezone(tz, config);
+}
+
+bool setTimezone(const char *tz) {
+  TzConfig config;
+  if (!parseTimezone(tz, config)) {
+    Serial.printf("Invalid timezone: %s\n", tz);
+    return false;
+  }
+
+  applyTimezone(tz, config);
+  return true;
+}
+
+bool saveTimezone(const char *tz) {
+  TzConfig config;
+  if (!parseTimezone(tz, config)) {
+    Serial.printf("Invalid timezone: %s\n", tz);
+    return false;
+  }
+
+  if (!updateConfiguration(
+          [tz](JsonDocument &doc) { doc["timezone"] = tz; })) {
+    Serial.println("Failed to write timezone to file");
+    return false;
+  }
+
+  Serial.println("Timezone saved successfully to /config.json");
+  applyTimezone(tz, config);
+  stateVersion++;
+  return true;
+}
+
+int32_t utcOffset(uint32_t utc) {
+  if (tzCount == 0 || utc < tzTable[0].utc || utc >= tzTableEnd) {
+    buildTable(yearFromDays(utc / SECONDS_PER_DAY));
+  }
+
+  if (utc < tzTable[tzCursor].utc) {
+    tzCursor = 0;
+  }
+  while (tzCursor + 1 < tzCount && utc >= tzTable[tzCursor + 1].utc) {
+    tzCursor++;
+  }
+  return tzTable[tzCursor].offset;
+}
+
+uint32_t utcToLocal(uint32_t utc) { return utc + utcOffset(utc); }
+
+uint32_t localToUtc(uint32_t local) {
+  int32_t maxOffset = max(stdOffset, dstOffset);
+  return local - utcOffset(local - maxOffset);
+}
+
+int32_t dstDelta() { return hasDst ? abs(dstOffset - stdOffset) : 0; }
@@ -3,15 +3,22 @@
 AsyncWebServer server(80);
 RTC_DS3231 rtc;
 WiFiUDP ntpUDP;
-NTPClient timeClient(ntpUDP, "pool.ntp.org", 19800);
+NTPClient timeClient(ntpUDP, "pool.ntp.org", 0);
 
 bool rtcFailed = false;
 bool ntpFailed = false;
-DateTime turnOff;
-DateTime turnOn;
+ScheduleRule turnOff;
+ScheduleRule turnOn;
 
 bool isOn = false;
+RTC_NOINIT_ATTR RelayState relayState;
 bool validOnOffTimes = false;
 
+uint32_t stateVersion = 0;
+
+unsigned long wifiConnectTime = 0;
+unsigned long wifiDhcpTime = 0;
+bool wifiFastConnect = false;
+
 const int errorLedPin = 10;
 const int relayPin = 9;
\ No newline at end of file
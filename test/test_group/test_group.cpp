@@ -0,0 +1,162 @@
+#include <GroupPacket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unity.h>
+#include <unistd.h>
+
+#define TEST_KEY "fleet-key"
+#define TEST_NOW 1790000000UL
+
+static GroupNonceRing ring;
+
+void setUp() { memset(&ring, 0, sizeof(ring)); }
+
+void tearDown() {}
+
+static GroupVerifyResult verify(const GroupPacket &packet, uint32_t now) {
+  GroupPacket decoded;
+  return verifyGroupPacket((const uint8_t *)&packet, sizeof(packet), TEST_KEY,
+                           now, ring, decoded);
+}
+
+void test_hmac_sha256_rfc4231() {
+  const char *key = "Jefe";
+  const char *data = "what do ya want for nothing?";
+  const uint8_t expected[32] = {
+      0x5b, 0xdc, 0xc1, 0x46, 0xbf, 0x60, 0x75, 0x4e, 0x6a, 0x04, 0x24,
+      0x26, 0x08, 0x95, 0x75, 0xc7, 0x5a, 0x00, 0x3f, 0x08, 0x9d, 0x27,
+      0x39, 0x83, 0x9d, 0xec, 0x58, 0xb9, 0x64, 0xec, 0x38, 0x43};
+  uint8_t mac[32];
+
+  hmacSha256((const uint8_t *)key, strlen(key), (const uint8_t *)data,
+             strlen(data), mac);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, mac, sizeof(mac));
+}
+
+void test_valid_packet() {
+  GroupPacket packet;
+  buildGroupPacket(packet, "porch", GROUP_ON, TEST_NOW, 1, 0, 0, TEST_KEY);
+  TEST_ASSERT_EQUAL(GROUP_VALID, verify(packet, TEST_NOW + 5));
+}
+
+void test_malformed_packet() {
+  GroupPacket packet, decoded;
+  buildGroupPacket(packet, "porch", GROUP_ON, TEST_NOW, 1, 0, 0, TEST_KEY);
+  TEST_ASSERT_EQUAL(GROUP_MALFORMED,
+                    verifyGroupPacket((const uint8_t *)&packet,
+                                      sizeof(packet) - 1, TEST_KEY, TEST_NOW,
+                                      ring, decoded));
+}
+
+void test_bad_mac() {
+  GroupPacket packet;
+  buildGroupPacket(packet, "porch", GROUP_ON, TEST_NOW, 1, 0, 0, TEST_KEY);
+  packet.command = GROUP_OFF;
+  TEST_ASSERT_EQUAL(GROUP_BAD_MAC, verify(packet, TEST_NOW));
+
+  buildGroupPacket(packet, "porch", GROUP_ON, TEST_NOW, 1, 0, 0, "other-key");
+  TEST_ASSERT_EQUAL(GROUP_BAD_MAC, verify(packet, TEST_NOW));
+}
+
+void test_stale_timestamp() {
+  GroupPacket packet;
+  buildGroupPacket(packet, "porch", GROUP_ON, TEST_NOW, 1, 0, 0, TEST_KEY);
+  TEST_ASSERT_EQUAL(GROUP_STALE,
+                    verify(packet, TEST_NOW + GROUP_TIME_WINDOW + 1));
+  TEST_ASSERT_EQUAL(GROUP_STALE,
+                    verify(packet, TEST_NOW - GROUP_TIME_WINDOW - 1));
+}
+
+void test_no_clock() {
+  GroupPacket packet;
+  buildGroupPacket(packet, "porch", GROUP_ON, TEST_NOW, 1, 0, 0, TEST_KEY);
+  TEST_ASSERT_EQUAL(GROUP_STALE, verify(packet, 0));
+
+  buildGroupPacket(packet, "porch", GROUP_ON, 0, 2, 0, 0, TEST_KEY);
+  TEST_ASSERT_EQUAL(GROUP_STALE, verify(packet, TEST_NOW));
+}
+
+void test_replayed_nonce() {
+  GroupPacket packet;
+  buildGroupPacket(packet, "porch", GROUP_TOGGLE, TEST_NOW, 42, 0, 0,
+                   TEST_KEY);
+  TEST_ASSERT_EQUAL(GROUP_VALID, verify(packet, TEST_NOW));
+  TEST_ASSERT_EQUAL(GROUP_REPLAY, verify(packet, TEST_NOW));
+}
+
+void test_loopback_multicast() {
+  int rx = socket(AF_INET, SOCK_DGRAM, 0);
+  int tx = socket(AF_INET, SOCK_DGRAM, 0);
+  TEST_ASSERT_TRUE(rx >= 0 && tx >= 0);
+
+  int reuse = 1;
+  setsockopt(rx, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  struct timeval timeout = {1, 0};
+  setsockopt(rx, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(GROUP_PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  struct ip_mreq membership = {};
+  membership.imr_multiaddr.s_addr = inet_addr(GROUP_ADDRESS);
+  membership.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+
+  struct in_addr loopback = {};
+  loopback.s_addr = htonl(INADDR_LOOPBACK);
+  unsigned char loop = 1;
+
+  if (bind(rx, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      setsockopt(rx, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership,
+                 sizeof(membership)) != 0 ||
+      setsockopt(tx, IPPROTO_IP, IP_MULTICAST_IF, &loopback,
+                 sizeof(loopback)) != 0 ||
+      setsockopt(tx, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) !=
+          0) {
+    close(rx);
+    close(tx);
+    TEST_IGNORE_MESSAGE("Multicast on loopback is not available");
+  }
+
+  GroupPacket packet;
+  buildGroupPacket(packet, "porch", GROUP_SCHEDULE, TEST_NOW, 7, 1000, 2000,
+                   TEST_KEY);
+  addr.sin_addr.s_addr = inet_addr(GROUP_ADDRESS);
+  ssize_t sent = sendto(tx, &packet, sizeof(packet), 0,
+                        (struct sockaddr *)&addr, sizeof(addr));
+  TEST_ASSERT_EQUAL(sizeof(packet), sent);
+
+  uint8_t buffer[256];
+  ssize_t received = recv(rx, buffer, sizeof(buffer), 0);
+  close(rx);
+  close(tx);
+  TEST_ASSERT_EQUAL(sizeof(packet), received);
+
+  GroupPacket decoded;
+  TEST_ASSERT_EQUAL(GROUP_VALID, verifyGroupPacket(buffer, received, TEST_KEY,
+                                                   TEST_NOW, ring, decoded));
+  TEST_ASSERT_EQUAL_STRING("porch", decoded.group);
+  TEST_ASSERT_EQUAL(GROUP_SCHEDULE, decoded.command);
+  TEST_ASSERT_EQUAL(1000, decoded.onTime);
+  TEST_ASSERT_EQUAL(2000, decoded.offTime);
+
+  TEST_ASSERT_EQUAL(GROUP_REPLAY, verifyGroupPacket(buffer, received, TEST_KEY,
+                                                    TEST_NOW, ring, decoded));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_hmac_sha256_rfc4231);
+  RUN_TEST(test_valid_packet);
+  RUN_TEST(test_malformed_packet);
+  RUN_TEST(test_bad_mac);
+  RUN_TEST(test_stale_timestamp);
+  RUN_TEST(test_no_clock);
+  RUN_TEST(test_replayed_nonce);
+  RUN_TEST(test_loopback_multicast);
+  return UNITY_END();
+}